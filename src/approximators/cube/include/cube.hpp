@@ -20,6 +20,9 @@ class Cube : public Approximator{
 		Cube(DataSet& dataset_, uint32_t window, uint32_t k, uint32_t probes, uint32_t points);
 		~Cube();
 
+		// Search-time knobs: vertices probed and points checked per query
+		void set_probes(uint32_t probes, uint32_t points);
+
 		std::vector<PAIR >
 		kANN(DataPoint& p, uint32_t k, Distance<uint8_t, uint8_t> dist) const override;
 
@@ -28,4 +31,6 @@ class Cube : public Approximator{
 
 		std::vector<PAIR> 
 		RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const override;
+
+		std::vector<uint32_t> candidates(DataPoint& query) const override;
 };
\ No newline at end of file
@@ -1,20 +1,22 @@
 #pragma once
 
-#include <unordered_map>
+#include <vector>
 #include "lsh_hash.hpp"
 
 
 class CubeHash {
     private:
         std::vector<LshHash*> lsh;
-        std::vector<std::unordered_map<uint32_t, uint8_t>> hash_maps;
+        std::vector<uint64_t> seeds;    // Random odd multipliers, one coin flip function per hash
         uint32_t k;
 
     public:
         CubeHash(uint32_t size, uint32_t window, uint32_t k_) : k(k_) {
             for (uint32_t i = 0; i < k; i++) {
                 lsh.push_back(new LshHash(size, window));
-                hash_maps.push_back(std::unordered_map<uint32_t, uint8_t>());
+
+                Vector<uint32_t> halves(2, UNIFORM, 0, UINT32_MAX);
+                seeds.push_back(((uint64_t)halves[0] << 32 | halves[1]) | 1);
             }
         }
 
@@ -29,13 +31,11 @@ class CubeHash {
             uint32_t value = 0;
 
             for (uint32_t i = 0; i < k; i++) {
-                uint32_t hvalue = lsh[i]->apply(p);
+                uint64_t hvalue = lsh[i]->apply(p);
 
-                // If not already computed, sample a value and store it
-                if (hash_maps[i].find(hvalue) == hash_maps[i].end()) 
-                    hash_maps[i][hvalue] = Vector<uint8_t>(1, UNIFORM, 0, 1)[0];
-                
-                value = (value << 1) | hash_maps[i][hvalue];
+                // Coin flip of the value: top bit of a random multiplicative hash. Nothing is stored,
+                // so that queries can run concurrently.
+                value = (value << 1) | (uint32_t)((hvalue * seeds[i]) >> 63);
             }
 
             return value;
@@ -24,6 +24,8 @@ try {
 	parser->add("probes", 	UINT, 	"2");
 	parser->add("N", 		UINT, 	"1");
 	parser->add("R", 		FLOAT, 	"10000.");
+	parser->add("sketch", 	UINT, 	"0");
+	parser->add("survivors",UINT, 	"100");
 
 	parser->parse(argc, argv);
 
@@ -76,6 +78,17 @@ try {
 	Cube cube(train, window, k, probes, points);
 	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl;
 
+	// Candidates are prefiltered by the Hamming distance of their sketches
+	Sketch* sketches = nullptr;
+	uint32_t bits = parser->value<uint32_t>("sketch");
+	if (bits > 0) {
+		swcout.start();
+		cout << "Computing sketches (" << bits << " bits per point)... " << flush;
+		sketches = new Sketch(train, bits);
+		cube.prefilter(sketches, parser->value<uint32_t>("survivors"));
+		cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl;
+	}
+
 	swcout.start();
 	cout << "Beginning search for \"" << query_path << "\"... " << flush;
 
@@ -130,6 +143,7 @@ try {
 	
 	output_file.close();
 	delete parser;
+	delete sketches;
 }
 catch (exception& e) {
 	cerr << e.what();
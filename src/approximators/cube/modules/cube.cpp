@@ -62,9 +62,14 @@ Cube::Cube(DataSet& dataset_, uint32_t window, uint32_t k, uint32_t probes_, uin
 
 Cube::~Cube() { }
 
+void Cube::set_probes(uint32_t probes_, uint32_t points_) { probes = probes_, points = points_; }
+
 
 vector< PAIR > 
 Cube::kANN(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const {
+
+	if (sketch != nullptr)
+		return filtered(query, k, dist);
 			
 	auto comparator = [](const PAIR t1, const PAIR t2) {
 		return t1.second > t2.second;
@@ -171,4 +176,28 @@ Cube::RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double>
     }    
 
 	return out;
-}
\ No newline at end of file
+}
+
+// Points of the probed vertices, at most "points" of them
+vector<uint32_t> Cube::candidates(DataPoint& query) const {
+
+	unordered_set<uint32_t> considered;
+	vector<uint32_t> out;
+
+    uint32_t vertex = htable.get_hash(query);
+    VertexHelper vertices(vertex, probes, k_);
+
+    for (uint32_t i = 0; i < points && !vertices.stop(); vertex = vertices.next(vertex)) {
+        for(auto p : htable.bucket(vertex)) {
+            if (!considered.insert(p.second->label()).second)
+                continue;
+
+            out.push_back(p.second->label());
+
+            if (++i >= points)
+                break;
+        }
+    }
+
+	return out;
+}
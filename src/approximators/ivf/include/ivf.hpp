@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "utils.hpp"
+#include "Vector.hpp"
+#include "Approximator.hpp"
+#include "ClusterModel.hpp"
+
+// Inverted file: the centroids of a Lloyd clustering (trained on a sample of the dataset) act as a
+// coarse quantizer. Every point is stored in the list of its closest centroid and a query only
+// scans the lists of its "nprobe" closest centroids. The lists are stored one after the other,
+// so the vectors of a list are contiguous in memory. A saved ClusterModel can stand in for the
+// clustering.
+class IVF : public Approximator {
+
+	private:
+		uint32_t nlist;
+		uint32_t nprobe;
+		const ClusterModel* quantizer;
+		ClusterModel* trained;                  // Quantizer trained by the constructor, if none was given
+		std::vector<uint32_t> offsets;          // List i holds entries offsets[i] to offsets[i + 1] - 1
+		std::vector<uint32_t> labels;           // Label of every entry
+		std::vector<Vector<uint8_t>*> entries;  // Copies of the points, backed by storage
+		uint8_t* storage;
+
+		// Lists of the points, by their closest centroid
+		void build();
+
+		// The "nprobe" lists closest to the query
+		std::vector<uint32_t> probe(const float* query) const;
+		std::vector<uint32_t> probe(Vector<uint8_t>& query) const;
+
+	public:
+		IVF(DataSet& dataset_, uint32_t nlist, uint32_t nprobe, uint32_t sample=4096);
+		IVF(DataSet& dataset_, const ClusterModel& quantizer, uint32_t nprobe);
+		~IVF();
+
+		uint32_t lists() const;
+		uint32_t probes() const;
+		void set_probes(uint32_t nprobe);
+
+		std::vector<PAIR>
+		kANN(DataPoint& p, uint32_t k, Distance<uint8_t, uint8_t> dist) const override;
+
+		std::vector<PAIR>
+		RangeSearch(DataPoint& query, double range, Distance<uint8_t, uint8_t> dist) const override;
+
+		std::vector<PAIR>
+		RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const override;
+
+		std::vector<uint32_t> candidates(DataPoint& query) const override;
+};
@@ -0,0 +1,213 @@
+#include <queue>
+#include <cfloat>
+#include <random>
+#include <algorithm>
+
+#include "ivf.hpp"
+#include "cluster.hpp"
+
+using namespace std;
+
+// Points assigned at a time
+#define CHUNK 1024
+
+
+IVF::IVF(DataSet& dataset_, uint32_t nlist_, uint32_t nprobe_, uint32_t sample)
+: Approximator(dataset_), nlist(nlist_), nprobe(nprobe_), quantizer(nullptr), trained(nullptr), storage(nullptr) {
+
+	if (nlist == 0 || nprobe == 0)
+		throw runtime_error("Exception in IVF creation: Number of lists and probes must be positive!\n");
+
+	// Coarse quantizer, trained on a random sample as in train_pq( )
+	vector<uint32_t> indexes(dataset.size());
+	for (uint32_t i = 0; i < indexes.size(); i++)
+		indexes[i] = i;
+
+	shuffle(indexes.begin(), indexes.end(), mt19937(random_device{}()));
+	indexes.resize(min(max(sample, nlist), dataset.size()));
+
+	DataSet training(dataset.dim());
+	for (auto index : indexes)
+		training.add(dataset[index]->data());
+
+	Lloyd lloyd(training, min(nlist, training.size()), l2_distance<uint8_t, double>, BATCH);
+	lloyd.apply();
+
+	// Seeding may pick fewer centers
+	quantizer = trained = lloyd.model();
+	build();
+}
+
+IVF::IVF(DataSet& dataset_, const ClusterModel& quantizer_, uint32_t nprobe_)
+: Approximator(dataset_), nlist(quantizer_.size()), nprobe(nprobe_), quantizer(&quantizer_), trained(nullptr), storage(nullptr) {
+
+	if (nprobe == 0)
+		throw runtime_error("Exception in IVF creation: Number of probes must be positive!\n");
+
+	if (quantizer->dim() != dataset.dim())
+		throw runtime_error("Exception in IVF creation: Dimensions of quantizer and dataset must match!\n");
+
+	build();
+}
+
+void IVF::build() {
+	uint32_t dim = dataset.dim();
+
+	nlist = quantizer->size();
+	nprobe = min(nprobe, nlist);
+
+	// Batched assignment of the whole dataset
+	vector<uint32_t> assigned(dataset.size());
+	vector<float> batch((size_t)CHUNK * dim);
+
+	for (uint32_t start = 0; start < dataset.size(); start += CHUNK) {
+		uint32_t count = min((uint32_t)CHUNK, dataset.size() - start);
+
+		for (uint32_t i = 0; i < count; i++) {
+			auto& vector = dataset[start + i]->data();
+			for (uint32_t d = 0; d < dim; d++)
+				batch[(size_t)i * dim + d] = vector[d];
+		}
+
+		quantizer->assign(batch.data(), count, assigned.data() + start);
+	}
+
+	// Counting sort of the points by list
+	offsets.assign(nlist + 1, 0);
+	for (auto list : assigned)
+		offsets[list + 1]++;
+
+	for (uint32_t c = 0; c < nlist; c++)
+		offsets[c + 1] += offsets[c];
+
+	vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	labels.resize(dataset.size());
+	for (uint32_t i = 0; i < dataset.size(); i++)
+		labels[next[assigned[i]]++] = dataset[i]->label();
+
+	storage = new uint8_t[(size_t)dataset.size() * dim];
+	entries.resize(dataset.size());
+	for (uint32_t i = 0; i < labels.size(); i++) {
+		entries[i] = new Vector<uint8_t>(dataset[labels[i] - 1]->data());
+		entries[i]->relocate(storage + (size_t)i * dim);
+	}
+}
+
+IVF::~IVF() {
+	for (auto entry : entries)
+		delete entry;
+
+	delete [] storage;
+	delete trained;
+}
+
+uint32_t IVF::lists() const { return nlist; }
+uint32_t IVF::probes() const { return nprobe; }
+void IVF::set_probes(uint32_t nprobe_) { nprobe = max(1u, min(nprobe_, nlist)); }
+
+vector<uint32_t> IVF::probe(const float* query) const {
+	vector<float> scores(nlist);
+	quantizer->scores(query, scores.data());
+
+	vector<pair<float, uint32_t>> distances(nlist);
+	for (uint32_t c = 0; c < nlist; c++)
+		distances[c] = pair(scores[c], c);
+
+	partial_sort(distances.begin(), distances.begin() + nprobe, distances.end());
+
+	vector<uint32_t> out(nprobe);
+	for (uint32_t i = 0; i < nprobe; i++)
+		out[i] = distances[i].second;
+
+	return out;
+}
+
+vector<uint32_t> IVF::probe(Vector<uint8_t>& query) const {
+	vector<float> converted(query.get(), query.get() + query.len());
+	return probe(converted.data());
+}
+
+
+vector< PAIR >
+IVF::kANN(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const {
+
+	if (sketch != nullptr)
+		return filtered(query, k, dist);
+
+	auto comparator = [](const PAIR t1, const PAIR t2) {
+		return t1.second < t2.second;
+	};
+
+	// Max heap of the k closest points so far
+	priority_queue<PAIR, vector<PAIR>, decltype(comparator)> pq(comparator);
+
+	for (auto list : probe(query.data())) {
+		for (uint32_t i = offsets[list]; i < offsets[list + 1]; i++) {
+			double distance = dist(query.data(), *entries[i]);
+
+			if (pq.size() < k)
+				pq.push(pair(labels[i], distance));
+			else if (distance < pq.top().second) {
+				pq.pop();
+				pq.push(pair(labels[i], distance));
+			}
+		}
+	}
+
+	vector< PAIR > out(pq.size());
+	for (uint32_t i = out.size(); i > 0; i--) {
+		out[i - 1] = pq.top();
+		pq.pop();
+	}
+
+	return out;
+}
+
+vector< PAIR >
+IVF::RangeSearch(DataPoint& query, double range, Distance<uint8_t, uint8_t> dist) const {
+
+	vector< PAIR > out;
+
+	for (auto list : probe(query.data())) {
+		for (uint32_t i = offsets[list]; i < offsets[list + 1]; i++) {
+			double distance = dist(query.data(), *entries[i]);
+
+			if (distance < range)
+				out.push_back(pair(labels[i], distance));
+		}
+	}
+
+	return out;
+}
+
+// Reverse Assignment
+vector< PAIR >
+IVF::RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const {
+
+	vector<float> converted(query.len());
+	for (uint32_t d = 0; d < query.len(); d++)
+		converted[d] = query[d];
+
+	vector< PAIR > out;
+
+	for (auto list : probe(converted.data())) {
+		for (uint32_t i = offsets[list]; i < offsets[list + 1]; i++) {
+			double distance = dist(*entries[i], query);
+
+			if (distance < range)
+				out.push_back(pair(labels[i], distance));
+		}
+	}
+
+	return out;
+}
+
+// Points of the probed lists
+vector<uint32_t> IVF::candidates(DataPoint& query) const {
+
+	vector<uint32_t> out;
+	for (auto list : probe(query.data()))
+		out.insert(out.end(), labels.begin() + offsets[list], labels.begin() + offsets[list + 1]);
+
+	return out;
+}
@@ -23,4 +23,6 @@ class LSH : public Approximator {
 
 		std::vector<PAIR> 
 		RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const override;
+
+		std::vector<uint32_t> candidates(DataPoint& query) const override;
 };
\ No newline at end of file
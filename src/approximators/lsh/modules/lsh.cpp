@@ -26,6 +26,9 @@ LSH::~LSH() {
 
 vector< PAIR > 
 LSH::kANN(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const{
+
+	if (sketch != nullptr)
+		return filtered(query, k, dist);
 			
 	auto comparator = [](const PAIR t1, const PAIR t2) {
 		return t1.second > t2.second;
@@ -115,3 +118,19 @@ LSH::RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double>
 	return out;
 }
 
+
+// Union of the query's buckets
+vector<uint32_t> LSH::candidates(DataPoint& query) const {
+
+	unordered_set<uint32_t> considered;
+	vector<uint32_t> out;
+
+	for (auto ht : htables) {
+		for(auto p : ht->bucket(query)) {
+			if (considered.insert(p.second->label()).second)
+				out.push_back(p.second->label());
+		}
+	}
+
+	return out;
+}
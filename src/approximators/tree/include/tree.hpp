@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+
+#include "utils.hpp"
+#include "Vector.hpp"
+#include "Approximator.hpp"
+
+// Node of a binary space partitioning tree. Nodes are stored in pre-order: the left child of node i
+// is node i + 1, so only the right one is stored. The points of a subtree are contiguous.
+typedef struct {
+	uint32_t begin, end;    // Positions of the points of the subtree
+	uint32_t right;         // Right child, 0 for leaves
+	uint32_t axis;          // Split dimension (kd-tree)
+	double split;           // Split value (kd-tree) or median distance to the vantage point (VP-tree)
+} Node;
+
+// Space partitioning trees for low-dimensional data (such as the latent vectors). The searches are
+// exact with epsilon = 0; otherwise subtrees that cannot hold a point closer than (1 + epsilon)
+// times the k-th distance found so far are skipped. Subtrees are built in parallel, and the points
+// are copied in tree order so that every leaf is scanned sequentially. Pruning assumes that the
+// distance given to the queries is the Euclidean one.
+class Tree : public Approximator {
+
+	protected:
+		double epsilon;
+		uint32_t leaf;                          // Maximum number of points of a leaf
+		std::vector<Node> nodes;
+		std::vector<uint32_t> labels;           // Label of the point at every position
+		std::vector<Vector<uint8_t>*> entries;  // Copies of the points, backed by storage
+		uint8_t* storage;
+
+		Tree(DataSet& dataset_, double epsilon, uint32_t leaf);
+
+		// Copies the points in the order of "labels"
+		void store();
+
+	public:
+		virtual ~Tree();
+
+		uint32_t size() const;
+		void set_epsilon(double epsilon);
+};
+
+// Splits at the median of the dimension with the largest spread
+class KDTree : public Tree {
+
+	private:
+		void build(uint32_t node, uint32_t begin, uint32_t end);
+
+		template <typename Query, typename Collector>
+		void search(uint32_t node, Query& query, Collector& collector) const;
+
+	public:
+		KDTree(DataSet& dataset_, double epsilon=0, uint32_t leaf=16);
+
+		std::vector<PAIR>
+		kANN(DataPoint& p, uint32_t k, Distance<uint8_t, uint8_t> dist) const override;
+
+		std::vector<PAIR>
+		RangeSearch(DataPoint& query, double range, Distance<uint8_t, uint8_t> dist) const override;
+
+		std::vector<PAIR>
+		RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const override;
+};
+
+// Splits at the median distance to a vantage point, the first point of the subtree
+class VPTree : public Tree {
+
+	private:
+		Distance<uint8_t, uint8_t> metric;      // Used for the construction
+
+		void build(uint32_t node, uint32_t begin, uint32_t end);
+
+		template <typename Query, typename Collector>
+		void search(uint32_t node, Query& query, Collector& collector) const;
+
+	public:
+		VPTree(DataSet& dataset_, Distance<uint8_t, uint8_t> metric, double epsilon=0, uint32_t leaf=16);
+
+		std::vector<PAIR>
+		kANN(DataPoint& p, uint32_t k, Distance<uint8_t, uint8_t> dist) const override;
+
+		std::vector<PAIR>
+		RangeSearch(DataPoint& query, double range, Distance<uint8_t, uint8_t> dist) const override;
+
+		std::vector<PAIR>
+		RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const override;
+};
@@ -0,0 +1,350 @@
+#include <queue>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+#include "tree.hpp"
+
+using namespace std;
+
+// Subtrees with fewer points are built by the thread that splits them
+#define PARALLEL 4096
+
+// k closest points (k > 0), or every point closer than "range" (k = 0)
+class Results {
+	private:
+		uint32_t k;
+		double range;
+		double factor;
+
+		static bool closer(const PAIR t1, const PAIR t2) { return t1.second < t2.second; }
+
+		// Max heap of the k closest points so far
+		priority_queue<PAIR, vector<PAIR>, decltype(&closer)> pq;
+		vector<PAIR> found;
+
+	public:
+		Results(uint32_t k_, double range_, double epsilon) : k(k_), range(range_), factor(1 + epsilon), pq(closer) { }
+
+		// A subtree is visited if some of its points can be within the distance bound
+		bool visit(double bound) const {
+			if (k == 0)
+				return bound < range;
+
+			return pq.size() < k || bound * factor < pq.top().second;
+		}
+
+		void add(uint32_t label, double distance) {
+			if (k == 0) {
+				if (distance < range)
+					found.push_back(pair(label, distance));
+				return ;
+			}
+
+			if (pq.size() < k)
+				pq.push(pair(label, distance));
+			else if (distance < pq.top().second) {
+				pq.pop();
+				pq.push(pair(label, distance));
+			}
+		}
+
+		// Sorted by distance for k > 0
+		vector<PAIR> get() {
+			if (k == 0)
+				return found;
+
+			vector<PAIR> out(pq.size());
+			for (uint32_t i = out.size(); i > 0; i--) {
+				out[i - 1] = pq.top();
+				pq.pop();
+			}
+
+			return out;
+		}
+};
+
+// Queries of either type, with the distance to a point of the tree
+struct ByteQuery {
+	Vector<uint8_t>& vector;
+	Distance<uint8_t, uint8_t> dist;
+
+	double operator[](uint32_t d) const { return vector[d]; }
+	double operator()(Vector<uint8_t>& point) const { return dist(vector, point); }
+};
+
+struct RealQuery {
+	Vector<double>& vector;
+	Distance<uint8_t, double> dist;
+
+	double operator[](uint32_t d) const { return vector[d]; }
+	double operator()(Vector<uint8_t>& point) const { return dist(point, vector); }
+};
+
+
+//////////
+// Tree //
+//////////
+
+Tree::Tree(DataSet& dataset_, double epsilon_, uint32_t leaf_)
+: Approximator(dataset_), epsilon(epsilon_), leaf(max(leaf_, 1u)), labels(dataset_.size()), storage(nullptr) {
+	for (uint32_t i = 0; i < labels.size(); i++)
+		labels[i] = dataset[i]->label();
+}
+
+Tree::~Tree() {
+	for (auto entry : entries)
+		delete entry;
+
+	delete [] storage;
+}
+
+void Tree::store() {
+	uint32_t dim = dataset.dim();
+
+	storage = new uint8_t[(size_t)labels.size() * dim];
+	entries.resize(labels.size());
+	for (uint32_t i = 0; i < labels.size(); i++) {
+		entries[i] = new Vector<uint8_t>(dataset[labels[i] - 1]->data());
+		entries[i]->relocate(storage + (size_t)i * dim);
+	}
+}
+
+uint32_t Tree::size() const { return nodes.size(); }
+void Tree::set_epsilon(double epsilon_) { epsilon = max(epsilon_, 0.); }
+
+
+/////////////
+// KD-Tree //
+/////////////
+
+// Nodes of a kd-tree over n points
+static uint32_t kd_nodes(uint32_t n, uint32_t leaf) {
+	return n <= leaf ? 1 : 1 + kd_nodes(n / 2, leaf) + kd_nodes(n - n / 2, leaf);
+}
+
+KDTree::KDTree(DataSet& dataset_, double epsilon_, uint32_t leaf_) : Tree(dataset_, epsilon_, leaf_) {
+	nodes.resize(kd_nodes(labels.size(), leaf));
+
+	#pragma omp parallel
+	#pragma omp single
+	build(0, 0, labels.size());
+
+	store();
+}
+
+void KDTree::build(uint32_t index, uint32_t begin, uint32_t end) {
+	Node& node = nodes[index];
+	uint32_t n = end - begin;
+
+	node.begin = begin, node.end = end, node.right = 0;
+	if (n <= leaf)
+		return ;
+
+	// Dimension with the largest spread
+	uint32_t dim = dataset.dim();
+	vector<uint8_t> low(dim, UINT8_MAX), high(dim, 0);
+	for (uint32_t p = begin; p < end; p++) {
+		auto& vector = dataset[labels[p] - 1]->data();
+		for (uint32_t d = 0; d < dim; d++) {
+			low[d]  = min(low[d], vector[d]);
+			high[d] = max(high[d], vector[d]);
+		}
+	}
+
+	node.axis = 0;
+	for (uint32_t d = 1; d < dim; d++) {
+		if (high[d] - low[d] > high[node.axis] - low[node.axis])
+			node.axis = d;
+	}
+
+	// Left points are at most the split value, right ones at least
+	uint32_t mid = begin + n / 2, axis = node.axis;
+	nth_element(labels.begin() + begin, labels.begin() + mid, labels.begin() + end,
+		[&](uint32_t l1, uint32_t l2) { return dataset[l1 - 1]->data()[axis] < dataset[l2 - 1]->data()[axis]; });
+
+	node.split = dataset[labels[mid] - 1]->data()[axis];
+	node.right = index + 1 + kd_nodes(n / 2, leaf);
+
+	uint32_t right = node.right;
+
+	#pragma omp task if(n > PARALLEL)
+	build(index + 1, begin, mid);
+
+	#pragma omp task if(n > PARALLEL)
+	build(right, mid, end);
+
+	#pragma omp taskwait
+}
+
+template <typename Query, typename Collector>
+void KDTree::search(uint32_t index, Query& query, Collector& collector) const {
+	const Node& node = nodes[index];
+
+	if (node.right == 0) {
+		for (uint32_t p = node.begin; p < node.end; p++)
+			collector.add(labels[p], query(*entries[p]));
+		return ;
+	}
+
+	double diff = query[node.axis] - node.split;
+
+	search(diff < 0 ? index + 1 : node.right, query, collector);
+
+	// Distance to the splitting hyperplane
+	if (collector.visit(fabs(diff)))
+		search(diff < 0 ? node.right : index + 1, query, collector);
+}
+
+vector<PAIR>
+KDTree::kANN(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const {
+
+	if (sketch != nullptr)
+		return filtered(query, k, dist);
+
+	ByteQuery q = { query.data(), dist };
+	Results collector(k, 0, epsilon);
+	if (k > 0)
+		search(0, q, collector);
+
+	return collector.get();
+}
+
+vector<PAIR>
+KDTree::RangeSearch(DataPoint& query, double range, Distance<uint8_t, uint8_t> dist) const {
+	ByteQuery q = { query.data(), dist };
+	Results collector(0, range, 0);
+	search(0, q, collector);
+
+	return collector.get();
+}
+
+// Reverse Assignment
+vector<PAIR>
+KDTree::RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const {
+	RealQuery q = { query, dist };
+	Results collector(0, range, 0);
+	search(0, q, collector);
+
+	return collector.get();
+}
+
+
+/////////////
+// VP-Tree //
+/////////////
+
+// Nodes of a VP-tree over n points, the vantage point of a node is in none of its children
+static uint32_t vp_nodes(uint32_t n, uint32_t leaf) {
+	return n <= leaf ? 1 : 1 + vp_nodes((n - 1) / 2, leaf) + vp_nodes(n - 1 - (n - 1) / 2, leaf);
+}
+
+VPTree::VPTree(DataSet& dataset_, Distance<uint8_t, uint8_t> metric_, double epsilon_, uint32_t leaf_)
+: Tree(dataset_, epsilon_, leaf_), metric(metric_) {
+	nodes.resize(vp_nodes(labels.size(), leaf));
+
+	#pragma omp parallel
+	#pragma omp single
+	build(0, 0, labels.size());
+
+	store();
+}
+
+void VPTree::build(uint32_t index, uint32_t begin, uint32_t end) {
+	Node& node = nodes[index];
+	uint32_t n = end - begin;
+
+	node.begin = begin, node.end = end, node.right = 0;
+	if (n <= leaf)
+		return ;
+
+	// Random vantage point, moved to the front of the subtree
+	swap(labels[begin], labels[begin + Vector<uint32_t>(1, UNIFORM, 0, n - 1)[0]]);
+	auto& vantage = dataset[labels[begin] - 1]->data();
+
+	vector<pair<double, uint32_t>> distances(n - 1);
+	for (uint32_t p = begin + 1; p < end; p++)
+		distances[p - begin - 1] = pair(metric(vantage, dataset[labels[p] - 1]->data()), labels[p]);
+
+	// Inside points are at most the median distance away, outside ones at least
+	uint32_t half = (n - 1) / 2;
+	nth_element(distances.begin(), distances.begin() + half, distances.end());
+
+	for (uint32_t i = 0; i < distances.size(); i++)
+		labels[begin + 1 + i] = distances[i].second;
+
+	uint32_t mid = begin + 1 + half;
+	node.split = distances[half].first;
+	node.right = index + 1 + vp_nodes(half, leaf);
+
+	uint32_t right = node.right;
+
+	#pragma omp task if(n > PARALLEL)
+	build(index + 1, begin + 1, mid);
+
+	#pragma omp task if(n > PARALLEL)
+	build(right, mid, end);
+
+	#pragma omp taskwait
+}
+
+template <typename Query, typename Collector>
+void VPTree::search(uint32_t index, Query& query, Collector& collector) const {
+	const Node& node = nodes[index];
+
+	if (node.right == 0) {
+		for (uint32_t p = node.begin; p < node.end; p++)
+			collector.add(labels[p], query(*entries[p]));
+		return ;
+	}
+
+	double distance = query(*entries[node.begin]);
+	collector.add(labels[node.begin], distance);
+
+	// By the triangle inequality, inside points are at least distance - split away, outside ones split - distance
+	if (distance < node.split) {
+		search(index + 1, query, collector);
+
+		if (collector.visit(node.split - distance))
+			search(node.right, query, collector);
+	}
+	else {
+		search(node.right, query, collector);
+
+		if (collector.visit(distance - node.split))
+			search(index + 1, query, collector);
+	}
+}
+
+vector<PAIR>
+VPTree::kANN(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const {
+
+	if (sketch != nullptr)
+		return filtered(query, k, dist);
+
+	ByteQuery q = { query.data(), dist };
+	Results collector(k, 0, epsilon);
+	if (k > 0)
+		search(0, q, collector);
+
+	return collector.get();
+}
+
+vector<PAIR>
+VPTree::RangeSearch(DataPoint& query, double range, Distance<uint8_t, uint8_t> dist) const {
+	ByteQuery q = { query.data(), dist };
+	Results collector(0, range, 0);
+	search(0, q, collector);
+
+	return collector.get();
+}
+
+// Reverse Assignment
+vector<PAIR>
+VPTree::RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const {
+	RealQuery q = { query, dist };
+	Results collector(0, range, 0);
+	search(0, q, collector);
+
+	return collector.get();
+}
@@ -0,0 +1,105 @@
+
+import io
+import re
+import json
+import struct
+import zipfile
+
+import h5py
+import numpy as np
+
+from argparse import ArgumentParser
+
+# Must match src/autoencoder/include/Encoder.hpp
+MAGIC = 0x454e4344
+CONV, POOL, DENSE = 1, 2, 3
+
+SKIPPED = ['InputLayer', 'Identity', 'Flatten', 'Dropout']
+
+def parse_args():
+    parser = ArgumentParser(description='Export an encoder for the C++ inference engine')
+
+    parser.add_argument('-m', type=str, default='./encoder.keras', help='Path to the encoder (.keras)')
+    parser.add_argument('-o', type=str, required=True, help='Path to the exported weights')
+
+    return parser.parse_args()
+
+# Keras names the weight groups of a container after the snake case class names of its layers
+def snake_case(name):
+    name = re.sub('(.)([A-Z][a-z]+)', r'\1_\2', name)
+    name = re.sub('([a-z])([A-Z])', r'\1_\2', name)
+    return name.lower()
+
+# Flattened (config, weights) pairs of the layers of nested Sequential models
+def walk(config, group):
+    counts = {}
+    for layer in config['config']['layers']:
+        if layer['class_name'] == 'InputLayer':
+            continue
+
+        base = snake_case(layer['class_name'])
+        name = base if base not in counts else f'{base}_{counts[base]}'
+        counts[base] = counts.get(base, 0) + 1
+
+        if layer['class_name'] in ['Sequential', 'Functional']:
+            yield from walk(layer, group['layers'][name])
+        else:
+            vars = group['layers'][name]['vars']
+            yield layer, [np.array(vars[str(i)]) for i in range(len(vars))]
+
+def input_shape(config):
+    for layer in config['config']['layers']:
+        if layer['class_name'] == 'InputLayer':
+            return layer['config']['batch_input_shape'][1:]
+
+        if layer['class_name'] == 'Sequential':
+            return input_shape(layer)
+
+def export(model_path, out_path):
+    with zipfile.ZipFile(model_path) as archive:
+        config = json.loads(archive.read('config.json'))
+        weights = h5py.File(io.BytesIO(archive.read('model.weights.h5')), 'r')
+
+    # [type, out, kernel, relu, ceiling, weights, bias]
+    layers = []
+    for layer, vars in walk(config, weights):
+        kind, params = layer['class_name'], layer['config']
+
+        if kind == 'Conv2D':
+            assert params['strides'] == [1, 1] and params['padding'] == 'same' and params['kernel_size'][0] == params['kernel_size'][1]
+            layers.append([CONV, params['filters'], params['kernel_size'][0], 0, 0., vars[0], vars[1]])
+        elif kind == 'Dense':
+            layers.append([DENSE, params['units'], 0, 0, 0., vars[0], vars[1]])
+        elif kind == 'MaxPooling2D':
+            assert params['pool_size'][0] == params['pool_size'][1] == params['strides'][0]
+            layers.append([POOL, params['pool_size'][0], 0, 0, 0., None, None])
+        elif kind == 'BatchNormalization':
+            # Folded into the preceding convolution or dense layer
+            assert layers and layers[-1][0] != POOL and not layers[-1][3]
+            gamma, beta, mean, variance = vars
+            scale = gamma / np.sqrt(variance + params['epsilon'])
+            layers[-1][5] = layers[-1][5] * scale
+            layers[-1][6] = (layers[-1][6] - mean) * scale + beta
+        elif kind == 'ReLU':
+            assert layers and layers[-1][0] != POOL and not params.get('negative_slope') and not params.get('threshold')
+            layers[-1][3] = 1
+            layers[-1][4] = params.get('max_value') or 0.
+        elif kind not in SKIPPED:
+            raise ValueError(f'Unsupported layer: {kind}')
+
+        if kind in ['Conv2D', 'Dense'] and params.get('activation') == 'relu':
+            layers[-1][3] = 1
+
+    h, w, c = input_shape(config)
+    with open(out_path, 'wb') as file:
+        file.write(struct.pack('<5I', MAGIC, h, w, c, len(layers)))
+
+        for kind, out, kernel, relu, ceiling, weight, bias in layers:
+            file.write(struct.pack('<4If', kind, out, kernel, relu, ceiling))
+            if kind != POOL:
+                weight.astype('<f4').tofile(file)
+                bias.astype('<f4').tofile(file)
+
+if __name__ == "__main__":
+    args = parse_args()
+    export(args.m, args.o)
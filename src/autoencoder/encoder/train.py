@@ -25,6 +25,7 @@ def parse_args():
     parser.add_argument('--batch_size', type=int, default=64, help='Batch size for training')
 
     parser.add_argument('--latent_dim', type=int, default=16, help='Latent Dimension')
+    parser.add_argument('--latent_type', type=str, default='uint8', choices=ELEMENTS.keys(), help='Element type of the latent files')
     parser.add_argument('--save', type=str, default='', help='Save model')
 
     return parser.parse_args()
@@ -37,13 +38,23 @@ def get_dataset(path):
         w = int.from_bytes(file.read(4), byteorder='big')
         return np.fromfile(file, dtype=np.uint8).reshape((size, h, w, 1))
 
-def write_dataset(path, encoded, magic_num=1234, latent_dim=16, cols=1):
+# IDX element type codes (third byte of the magic number) and big endian numpy types,
+# float16 has no IDX code and uses a free one
+ELEMENTS = { 'uint8': (0x04, np.uint8), 'float32': (0x0D, '>f4'), 'float16': (0x0A, '>f2') }
+
+def write_dataset(path, encoded, latent_type='uint8', latent_dim=16, cols=1):
+    code, dtype = ELEMENTS[latent_type]
     with open(path, 'wb') as file:
-        file.write(magic_num.to_bytes(4, byteorder='big'))
+        file.write(bytes([0, 0, code, 0xd2 if latent_type == 'uint8' else 3]))
         file.write(encoded.shape[0].to_bytes(4, byteorder='big'))
         file.write(latent_dim.to_bytes(4, byteorder='big'))
         file.write(cols.to_bytes(4, byteorder='big'))
-        encoded.astype(np.uint8).tofile(file)
+
+        # Bytes are rounded to the nearest value (they used to be truncated by astype), as by the encoder
+        # driver for its queries, so both sides of a search quantize alike
+        if latent_type == 'uint8':
+            encoded = np.clip(np.rint(encoded), 0, 255)
+        encoded.reshape(encoded.shape[0], -1).astype(dtype).tofile(file)
 
 def train_model(train_path, test_path, latent_dim, planes, depth, norm, 
                 kernel_size, lr, batch_size, epochs, save=''):
@@ -93,5 +104,5 @@ if __name__ == "__main__":
     encoded_train, encoded_test = train_model(train_path, test_path, latent_dim, planes, depth, 
                                               norm, kernel_size, lr, batch_size, epochs, save=args.save)
 
-    write_dataset(args.latent_train_path, encoded_train)
-    write_dataset(args.latent_test_path, encoded_test)
\ No newline at end of file
+    write_dataset(args.latent_train_path, encoded_train, args.latent_type, latent_dim)
+    write_dataset(args.latent_test_path, encoded_test, args.latent_type, latent_dim)
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define ENCODER_MAGIC 0x454e4344
+
+typedef enum { CONV = 1, POOL = 2, DENSE = 3 } LayerType;
+
+// One layer of an exported encoder. Activations are stored channels last (h x w x c), as in Keras,
+// so the input of a DENSE layer is the flattened output of the previous one.
+typedef struct {
+    LayerType type;
+    uint32_t h, w, c;           // Input shape
+    uint32_t out;               // Filters (CONV), units (DENSE) or pool size (POOL)
+    uint32_t kernel;            // Kernel size (CONV)
+    bool relu;
+    float ceiling;              // Upper clip of the ReLU, none if 0
+    std::vector<float> weights; // kernel x kernel x c x out (CONV), (h * w * c) x out (DENSE)
+    std::vector<float> bias;
+} Layer;
+
+// Inference of a convolutional encoder exported by encoder/export.py. Images are processed in
+// batches of up to "batch" images, one layer at a time, so every weight is loaded once per batch.
+class Encoder {
+    private:
+        uint32_t h, w, c;
+        uint32_t batch;
+        std::vector<Layer> layers;
+        std::vector<float> buffers[2];
+
+        void conv(const Layer& layer, const float* in, float* out, uint32_t count) const;
+        void pool(const Layer& layer, const float* in, float* out, uint32_t count) const;
+        void dense(const Layer& layer, const float* in, float* out, uint32_t count) const;
+    public:
+        Encoder(std::string path, uint32_t batch=64);
+
+        uint32_t input() const;
+        uint32_t output() const;
+
+        // Maps "count" images of input() pixels (scaled from [0, 255] to [0, 1]) to count x output() latent values
+        void encode(const uint8_t* images, uint32_t count, float* out);
+};
@@ -1,9 +1,13 @@
 #include <iostream>
 #include <cfloat>
+#include <cmath>
+#include <algorithm>
 
 #include "Graph.hpp"
+#include "Encoder.hpp"
 #include "lsh.hpp"
 #include "cube.hpp"
+#include "tree.hpp"
 #include "ArgParser.hpp"
 
 using namespace std;
@@ -24,6 +28,63 @@ static string get_arg(ArgParser& parser, string flag, string msg) {
 	return ret;
 }
 
+static void keep_closest(vector<PAIR>& results, uint32_t N) {
+    sort(results.begin(), results.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+    if (results.size() > N)
+        results.resize(N);
+}
+
+// Re-scores the results with the full precision vectors of a float DataSet, keeping the closest N
+static void refine(DataSet& dataset, const float* query, vector<PAIR>& results, uint32_t N) {
+    for (auto& p : results)
+        p.second = dataset.distance(query, p.first);
+
+    keep_closest(results, N);
+}
+
+// Second stage of the search: the latent candidates are re-ranked with their exact distances 
+// in the original space, keeping the closest N. Both datasets share the labels.
+static void rerank(DataSet& dataset, Vector<uint8_t>& query, vector<PAIR>& candidates, uint32_t N) {
+    for (auto& p : candidates)
+        p.second = l2_distance(query, dataset[p.first - 1]->data());
+
+    keep_closest(candidates, N);
+}
+
+// Exhaustive scan of scalar quantized codes, returns the closest "size" points
+static vector<PAIR> scan(const ScalarQuantizer& sq, const vector<uint8_t>& codes, const float* query, uint32_t size) {
+    auto table = sq.table(query);
+
+    vector<PAIR> out;
+    for (uint32_t i = 0, count = codes.size() / sq.bytes(); i < count; i++)
+        out.push_back(pair(i + 1, sq.distance(table, codes.data() + (size_t)i * sq.bytes())));
+
+    size = min((size_t)size, out.size());
+    partial_sort(out.begin(), out.begin() + size, out.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+    out.resize(size);
+
+    return out;
+}
+
+// Maps an image to the latent space and to the representation of the latent DataSet: scaled to [0, 255]
+// as by reduce.py, then rounded to the nearest byte (np.rint and clip in write_dataset) or, for float
+// DataSets, quantized with the DataSet's quantizer
+static void to_latent(Encoder& encoder, Vector<uint8_t>& image, const ScalarQuantizer* sq, 
+                      vector<float>& latent, Vector<uint8_t>& code) {
+    encoder.encode(image.get(), 1, latent.data());
+
+    for (auto& value : latent)
+        value *= 255;
+
+    if (sq != nullptr) {
+        sq->encode(latent.data(), code.get());
+        return ;
+    }
+
+    for (uint32_t d = 0; d < latent.size(); d++)
+        code[d] = min(max(lrintf(latent[d]), 0L), 255L);
+}
+
 int main(int argc, const char* argv[]) {
 try {
     ArgParser parser = ArgParser();
@@ -38,8 +99,17 @@ try {
     parser.add("R", UINT, "1");
     parser.add("N", UINT, "1");
     parser.add("l", UINT, "20");
+    parser.add("entries", UINT, "0");
+    parser.add("seeds", UINT, "1");
     parser.add("m", STRING);
     parser.add("a", STRING, "LSH");
+    parser.add("rerank", UINT, "0");
+    parser.add("C", UINT, "0");
+    parser.add("bits", UINT, "0");
+    parser.add("tree", STRING);
+    parser.add("eps", FLOAT, "0");
+    parser.add("w", STRING);
+    parser.add("batch", UINT, "64");
     parser.add("save", STRING);
     parser.add("load", STRING);
     parser.parse(argc, argv);
@@ -49,11 +119,16 @@ try {
 
     
 	uint32_t k = parser.value<uint32_t>("k");
-	uint32_t E = parser.value<uint32_t>("E");
-	uint32_t R = parser.value<uint32_t>("R");
-    uint32_t T = 10;
-	uint32_t N = parser.value<uint32_t>("N");
-	uint32_t l = parser.value<uint32_t>("l");
+	uint32_t entries = parser.value<uint32_t>("entries");
+
+    SearchParams params;
+    params.N     = parser.value<uint32_t>("N");
+    params.R     = parser.value<uint32_t>("R");
+    params.T     = 10;
+    params.E     = parser.value<uint32_t>("E");
+    params.L     = parser.value<uint32_t>("l");
+    params.seeds = parser.value<uint32_t>("seeds");
+	uint32_t N   = params.N;
     
     string approx_method = parser.value<string>("a");
 
@@ -66,7 +141,12 @@ try {
     out_path   = get_arg(parser, "o", "Enter path to output file: ");
 
     input_path_latent = get_arg(parser, "dl", "Enter path to input file (Latent Space): ");
-    query_path_latent = get_arg(parser, "ql", "Enter path to query file (Latent Space): ");
+
+    // With exported encoder weights, queries are mapped to the latent space in process
+    string weights_path = parser.parsed("w") ? parser.value<string>("w") : "";
+    if (weights_path.empty()) {
+        query_path_latent = get_arg(parser, "ql", "Enter path to query file (Latent Space): ");
+    }
 
 	ofstream output_file(out_path, ios::out);
 	if (output_file.fail()) 
@@ -86,6 +166,17 @@ try {
     DataSet train_dataset_latent(input_path_latent);
     cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
     
+    Encoder* encoder = nullptr;
+    if (!weights_path.empty()) {
+        cout << "Loading encoder... " << flush;
+        timer.start();
+        encoder = new Encoder(weights_path, parser.value<uint32_t>("batch"));
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+
+        if (encoder->input() != train_dataset.dim() || encoder->output() != train_dataset_latent.dim())
+            throw runtime_error("Invalid Encoder: It does not map the input space to the latent space!\n");
+    }
+    
     cout << "Initializing Approximators... " << flush;
     timer.start();
     Approximator approx = Approximator(train_dataset);
@@ -97,11 +188,57 @@ try {
     timer.start();
     Graph* graph = 
     graph_method == "1" ? 
-        (Graph*)new GNNS(train_dataset_latent, &approx_latent, l2_distance, k, R, T, E, load_path) :
+        (Graph*)new GNNS(train_dataset_latent, &approx_latent, l2_distance, k, load_path) :
     graph_method == "2" ?
-        (Graph*)new MRNG(train_dataset_latent, &approx_latent, l2_distance, l2_distance, k, l, load_path) :
+        (Graph*)new MRNG(train_dataset_latent, &approx_latent, l2_distance, l2_distance, k, entries, load_path) :
     NULL;
     cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+
+    // Brute force through a kd-tree or VP-tree of the latent vectors, exact unless eps > 0
+    string tree_method = parser.parsed("tree") ? parser.value<string>("tree") : "";
+    Tree* tree = nullptr;
+    if (graph_method == "3" && !tree_method.empty()) {
+        if (tree_method != "kd" && tree_method != "vp")
+            throw runtime_error("Invalid Tree: Valid options are 'kd' and 'vp'");
+
+        cout << "Creating " << tree_method << "-tree... " << flush;
+        timer.start();
+        double eps = parser.value<float>("eps");
+        tree = tree_method == "kd" ? 
+            (Tree*)new KDTree(train_dataset_latent, eps) : 
+            (Tree*)new VPTree(train_dataset_latent, l2_distance, eps);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+    }
+
+    // Float latent files: candidates found on the 8-bit codes are re-ranked on the full precision vectors
+    bool floating = train_dataset_latent.floating();
+    // With C > 0, the latent search returns C candidates that are re-ranked in the original space
+    uint32_t C = parser.value<uint32_t>("C");
+    uint32_t candidates = max(N, C);
+
+    SearchParams extended = params;
+    extended.N = candidates;
+    if (floating)
+        extended.N = max(candidates, parser.value<uint32_t>("rerank"));
+
+    // The MRNG pool must hold every candidate
+    extended.L = max(extended.L, extended.N);
+
+    // Brute force on compact (4 or 8-bit) codes instead of the latent vectors
+    uint32_t bits = parser.value<uint32_t>("bits");
+    ScalarQuantizer* compact = nullptr;
+    vector<uint8_t> codes;
+    if (bits > 0 && floating) {
+        uint32_t count = train_dataset_latent.size();
+
+        cout << "Encoding latent vectors (" << bits << " bits per dimension)... " << flush;
+        timer.start();
+        compact = new ScalarQuantizer(train_dataset_latent.real(1), count, train_dataset_latent.dim(), bits);
+        codes.resize((size_t)count * compact->bytes());
+        for (uint32_t i = 0; i < count; i++)
+            compact->encode(train_dataset_latent.real(i + 1), codes.data() + (size_t)i * compact->bytes());
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+    }
     
     if (!save_path.empty()) {
         cout << "Saving graph... " << flush;
@@ -113,20 +250,43 @@ try {
 	timer_out.start();
 	while (true) {
 	cout << "Beginning search for \"" << query_path << "\"... " << flush;
-        double ttime_graph = 0, ttime_true = 0;
+        double ttime_graph = 0, ttime_true = 0, ttime_encode = 0;
         double total_AF = 0, total_MAF = 0;
 
         DataSet test(query_path, QUERIES);
-        DataSet test_latent(query_path_latent, QUERIES);
+        DataSet* test_latent = encoder ? nullptr : new DataSet(query_path_latent, QUERIES, train_dataset_latent.quantizer());
+
+        Stopwatch timer_encode;
+        vector<float> latent(train_dataset_latent.dim());
+        Vector<uint8_t> encoded(train_dataset_latent.dim());
 
 		for (size_t i = 0; i < QUERIES; i++) {
             auto point = test[i];
-            auto point_latent = test_latent[i];
 
 			timer.start();
+            if (encoder) {
+                timer_encode.start();
+                to_latent(*encoder, point->data(), train_dataset_latent.quantizer(), latent, encoded);
+                ttime_encode += timer_encode.stop();
+            }
+
+            Vector<uint8_t>& query = encoder ? encoded : (*test_latent)[i]->data();
+            const float* query_real = encoder ? latent.data() : test_latent->real(i + 1);
+            DataPoint query_point(query, 0);
+
 			auto aknn_graph = graph ? 
-                                graph->query(point_latent->data(), N) : 
-                                approx_latent.kNN(*point_latent, 10, l2_distance);
+                                graph->query(query, extended) : 
+                              compact ?
+                                scan(*compact, codes, query_real, extended.N) :
+                              tree ?
+                                tree->kANN(query_point, extended.N, l2_distance) :
+                                approx_latent.kNN(query_point, extended.N, l2_distance);
+
+            if (floating)
+                refine(train_dataset_latent, query_real, aknn_graph, candidates);
+
+            if (C > 0)
+                rerank(train_dataset, point->data(), aknn_graph, N);
 			double graph_time = timer.stop();
 
 			timer.start();
@@ -171,6 +331,27 @@ try {
 
 		cout << "Done! (" << std::fixed << std::setprecision(3) << timer_out.stop() << " seconds)" << endl; 
 
+        if (encoder) {
+            // Throughput of the same queries encoded in batches
+            vector<uint8_t> images;
+            for (size_t i = 0; i < QUERIES; i++)
+                images.insert(images.end(), test[i]->data().get(), test[i]->data().get() + test.dim());
+
+            vector<float> batched((size_t)QUERIES * encoder->output());
+            timer.start();
+            encoder->encode(images.data(), QUERIES, batched.data());
+            double batch_time = timer.stop();
+
+            cout << 
+            "Average encoding time (ms): " << 
+            std::fixed << std::setprecision(4) << 1000 * ttime_encode / QUERIES << 
+            " (" << 1000 * batch_time / QUERIES << " batched)" << endl;
+
+            cout << 
+            "Average end-to-end query time, encoding included (ms): " << 
+            std::fixed << std::setprecision(4) << 1000 * ttime_graph / QUERIES << endl;
+        }
+
 		cout << 
         "Relative time performance (Graph time / True time): " << 
         std::fixed << std::setprecision(4) << ttime_graph / ttime_true << endl; 
@@ -186,9 +367,14 @@ try {
 		cout << "\nEnter path to new query file (Nothing in order to stop): " << flush;
 		getline(cin, query_path);
 
+        delete test_latent;
+
 		if (query_path.empty()) 
 			break;
 
+        if (encoder)
+            continue;
+
 		cout << "\nEnter path to new query file (Latent space) (Nothing in order to stop): " << flush;
 		getline(cin, query_path_latent);
 
@@ -200,6 +386,10 @@ try {
 
     if (graph)
         delete graph;
+
+    delete tree;
+    delete compact;
+    delete encoder;
 } 
 catch (exception& e) {
     cerr << e.what();
@@ -0,0 +1,268 @@
+#include "Encoder.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// y += a * x
+static inline void axpy(float a, const float* x, float* y, uint32_t n) {
+    uint32_t i = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 va = _mm256_set1_ps(a);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+#endif
+
+    for (; i < n; i++)
+        y[i] += a * x[i];
+}
+
+static inline void activate(const Layer& layer, float* values, uint32_t n) {
+    if (!layer.relu)
+        return ;
+
+    for (uint32_t i = 0; i < n; i++) {
+        values[i] = max(values[i], 0.f);
+        if (layer.ceiling > 0)
+            values[i] = min(values[i], layer.ceiling);
+    }
+}
+
+// Values per image at the output of a layer
+static uint32_t size(const Layer& layer) {
+    switch (layer.type) {
+        case CONV:  return layer.h * layer.w * layer.out;
+        case POOL:  return (layer.h / layer.out) * (layer.w / layer.out) * layer.c;
+        default:    return layer.out;
+    }
+}
+
+Encoder::Encoder(string path, uint32_t batch_) : batch(max(batch_, 1u)) {
+    ifstream input(path, ios::binary);
+
+    if (input.fail())
+        throw runtime_error("Exception in Encoder creation: " + path + " could not be opened!\n");
+
+    uint32_t magic, count;
+    input.read((char*)&magic, 4);
+    input.read((char*)&h, 4);
+    input.read((char*)&w, 4);
+    input.read((char*)&c, 4);
+    input.read((char*)&count, 4);
+
+    if (input.fail() || magic != ENCODER_MAGIC)
+        throw runtime_error("Exception in Encoder creation: " + path + " is not an exported encoder!\n");
+
+    // Input shape of the next layer
+    uint32_t lh = h, lw = w, lc = c;
+    size_t largest = (size_t)h * w * c;
+
+    for (uint32_t i = 0; i < count; i++) {
+        Layer layer;
+        uint32_t type, relu;
+
+        input.read((char*)&type, 4);
+        input.read((char*)&layer.out, 4);
+        input.read((char*)&layer.kernel, 4);
+        input.read((char*)&relu, 4);
+        input.read((char*)&layer.ceiling, 4);
+
+        layer.type = (LayerType)type;
+        layer.relu = relu;
+        layer.h = lh, layer.w = lw, layer.c = lc;
+
+        size_t weights = 0;
+        if (layer.type == CONV)
+            weights = (size_t)layer.kernel * layer.kernel * lc * layer.out;
+        else if (layer.type == DENSE)
+            weights = (size_t)lh * lw * lc * layer.out;
+        else if (layer.type != POOL || layer.out == 0)
+            throw runtime_error("Exception in Encoder creation: Unknown layer in " + path + "!\n");
+
+        if (layer.type != POOL) {
+            layer.weights.resize(weights);
+            layer.bias.resize(layer.out);
+            input.read((char*)layer.weights.data(), weights * sizeof(float));
+            input.read((char*)layer.bias.data(), layer.out * sizeof(float));
+        }
+
+        if (input.fail())
+            throw runtime_error("Exception in Encoder creation: " + path + " is truncated!\n");
+
+        if (layer.type == CONV)
+            lc = layer.out;
+        else if (layer.type == POOL)
+            lh /= layer.out, lw /= layer.out;
+        else
+            lh = lw = 1, lc = layer.out;
+
+        largest = max(largest, (size_t)size(layer));
+        layers.push_back(layer);
+    }
+
+    if (layers.empty())
+        throw runtime_error("Exception in Encoder creation: " + path + " has no layers!\n");
+
+    for (auto& buffer : buffers)
+        buffer.resize(largest * batch);
+}
+
+uint32_t Encoder::input() const { return h * w * c; }
+uint32_t Encoder::output() const { return size(layers.back()); }
+
+#if defined(__AVX2__) && defined(__FMA__)
+// Output pixel of a convolution with V x 8 filters, the accumulators stay in registers
+template <uint32_t V>
+static inline void conv_pixel(const Layer& layer, const float* in, float* acc, uint32_t y, uint32_t x) {
+    uint32_t K = layer.kernel, pad = (K - 1) / 2;
+
+    __m256 sum[V];
+    for (uint32_t v = 0; v < V; v++)
+        sum[v] = _mm256_loadu_ps(layer.bias.data() + 8 * v);
+
+    for (uint32_t ky = 0; ky < K; ky++) {
+        int iy = (int)(y + ky) - (int)pad;
+        if (iy < 0 || iy >= (int)layer.h)
+            continue;
+
+        for (uint32_t kx = 0; kx < K; kx++) {
+            int ix = (int)(x + kx) - (int)pad;
+            if (ix < 0 || ix >= (int)layer.w)
+                continue;
+
+            const float* pixel = in + (iy * layer.w + ix) * layer.c;
+            const float* weight = layer.weights.data() + (size_t)(ky * K + kx) * layer.c * 8 * V;
+
+            for (uint32_t ci = 0; ci < layer.c; ci++, weight += 8 * V) {
+                __m256 value = _mm256_set1_ps(pixel[ci]);
+                for (uint32_t v = 0; v < V; v++)
+                    sum[v] = _mm256_fmadd_ps(value, _mm256_loadu_ps(weight + 8 * v), sum[v]);
+            }
+        }
+    }
+
+    for (uint32_t v = 0; v < V; v++)
+        _mm256_storeu_ps(acc + 8 * v, sum[v]);
+}
+#endif
+
+// Stride 1, "same" padding
+void Encoder::conv(const Layer& layer, const float* in, float* out, uint32_t count) const {
+    uint32_t K = layer.kernel, pad = (K - 1) / 2;
+    uint32_t insize = layer.h * layer.w * layer.c, outsize = size(layer);
+
+    for (uint32_t b = 0; b < count; b++, in += insize, out += outsize) {
+        for (uint32_t y = 0; y < layer.h; y++) {
+            for (uint32_t x = 0; x < layer.w; x++) {
+                float* acc = out + (y * layer.w + x) * layer.out;
+
+#if defined(__AVX2__) && defined(__FMA__)
+                // Common filter counts
+                switch (layer.out) {
+                    case 8:  conv_pixel<1>(layer, in, acc, y, x); continue;
+                    case 16: conv_pixel<2>(layer, in, acc, y, x); continue;
+                    case 32: conv_pixel<4>(layer, in, acc, y, x); continue;
+                    case 48: conv_pixel<6>(layer, in, acc, y, x); continue;
+                    case 64: conv_pixel<8>(layer, in, acc, y, x); continue;
+                }
+#endif
+                copy(layer.bias.begin(), layer.bias.end(), acc);
+
+                for (uint32_t ky = 0; ky < K; ky++) {
+                    int iy = (int)(y + ky) - (int)pad;
+                    if (iy < 0 || iy >= (int)layer.h)
+                        continue;
+
+                    for (uint32_t kx = 0; kx < K; kx++) {
+                        int ix = (int)(x + kx) - (int)pad;
+                        if (ix < 0 || ix >= (int)layer.w)
+                            continue;
+
+                        const float* pixel = in + (iy * layer.w + ix) * layer.c;
+                        const float* weight = layer.weights.data() + (size_t)(ky * K + kx) * layer.c * layer.out;
+
+                        for (uint32_t ci = 0; ci < layer.c; ci++, weight += layer.out)
+                            axpy(pixel[ci], weight, acc, layer.out);
+                    }
+                }
+            }
+        }
+
+        activate(layer, out, outsize);
+    }
+}
+
+// Stride equal to the pool size, "valid" padding
+void Encoder::pool(const Layer& layer, const float* in, float* out, uint32_t count) const {
+    uint32_t P = layer.out, oh = layer.h / P, ow = layer.w / P;
+    uint32_t insize = layer.h * layer.w * layer.c, outsize = size(layer);
+
+    for (uint32_t b = 0; b < count; b++, in += insize, out += outsize) {
+        for (uint32_t y = 0; y < oh; y++) {
+            for (uint32_t x = 0; x < ow; x++) {
+                float* max_values = out + (y * ow + x) * layer.c;
+                copy_n(in + ((y * P) * layer.w + x * P) * layer.c, layer.c, max_values);
+
+                for (uint32_t py = 0; py < P; py++) {
+                    for (uint32_t px = 0; px < P; px++) {
+                        const float* pixel = in + ((y * P + py) * layer.w + x * P + px) * layer.c;
+                        for (uint32_t ci = 0; ci < layer.c; ci++)
+                            max_values[ci] = max(max_values[ci], pixel[ci]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Every row of the weights is applied to the whole batch before moving to the next one
+void Encoder::dense(const Layer& layer, const float* in, float* out, uint32_t count) const {
+    uint32_t insize = layer.h * layer.w * layer.c;
+
+    for (uint32_t b = 0; b < count; b++)
+        copy(layer.bias.begin(), layer.bias.end(), out + (size_t)b * layer.out);
+
+    const float* row = layer.weights.data();
+    for (uint32_t i = 0; i < insize; i++, row += layer.out) {
+        for (uint32_t b = 0; b < count; b++) {
+            float value = in[(size_t)b * insize + i];
+            if (value != 0)
+                axpy(value, row, out + (size_t)b * layer.out, layer.out);
+        }
+    }
+
+    activate(layer, out, count * layer.out);
+}
+
+void Encoder::encode(const uint8_t* images, uint32_t count, float* out) {
+    uint32_t pixels = input(), latent = output();
+
+    for (uint32_t start = 0; start < count; start += batch) {
+        uint32_t size = min(batch, count - start);
+
+        float* current = buffers[0].data();
+        float* next = buffers[1].data();
+
+        for (size_t i = 0; i < (size_t)size * pixels; i++)
+            current[i] = images[(size_t)start * pixels + i] / 255.f;
+
+        for (auto& layer : layers) {
+            if (layer.type == CONV)
+                conv(layer, current, next, size);
+            else if (layer.type == POOL)
+                pool(layer, current, next, size);
+            else
+                dense(layer, current, next, size);
+
+            swap(current, next);
+        }
+
+        copy_n(current, (size_t)size * latent, out + (size_t)start * latent);
+    }
+}
@@ -1,5 +1,5 @@
 
-from encoder.train import get_dataset, write_dataset
+from encoder.train import get_dataset, write_dataset, ELEMENTS
 import keras
 
 from argparse import ArgumentParser
@@ -11,6 +11,7 @@ def parse_args():
     parser.add_argument('-q', type=str, required=True, help='Path to query data')
     parser.add_argument('-od', type=str, required=True, help='Path to training data (latent space)')
     parser.add_argument('-oq', type=str, required=True, help='Path to query data (latent space)')
+    parser.add_argument('-t', type=str, default='uint8', choices=ELEMENTS.keys(), help='Element type of the latent files')
 
     return parser.parse_args()
 
@@ -22,5 +23,5 @@ if __name__ == "__main__":
     train_data = get_dataset(args.d) / 255.
     test_data = get_dataset(args.q) / 255.
 
-    write_dataset(args.od, encoder.predict(train_data) * 255)
-    write_dataset(args.oq, encoder.predict(test_data) * 255)
\ No newline at end of file
+    write_dataset(args.od, encoder.predict(train_data) * 255, args.t)
+    write_dataset(args.oq, encoder.predict(test_data) * 255, args.t)
\ No newline at end of file
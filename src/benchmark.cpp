@@ -5,21 +5,26 @@
 #include <cmath>
 #include <string>
 #include <filesystem>
+#include <omp.h>
 
 #include "utils.hpp"
+#include "Histogram.hpp"
 #include "HashTable.hpp"
 #include "ArgParser.hpp"
 #include "FileParser.hpp"
 #include "lsh.hpp"
 #include "cube.hpp"
+#include "ivf.hpp"
 #include "Graph.hpp"
 
 #define _LSH  0
 #define _CUBE 1
 #define _GNNS 2
 #define _MRNG 3
+#define _HNSW 4
+#define _IVF  5
 
-static const char* names[] = {"LSH ", "Cube", "GNNS", "MRNG"};
+static const char* names[] = {"LSH ", "Cube", "GNNS", "MRNG", "HNSW", "IVF "};
 
 #define CALL_ASSERT(algo, call) 												\
 	vec = call;																	\
@@ -30,9 +35,13 @@ static const char* names[] = {"LSH ", "Cube", "GNNS", "MRNG"};
 	pair = vec[0];																\
 
 #define METRICS(algo, call)											\
+	if (!team.empty()) team[0]->start();							\
 	swcout.start();													\
 	CALL_ASSERT(algo, call)											\
-	rtime[algo] += swcout.stop();									\
+	latency = swcout.elapsed();										\
+	if (!team.empty()) add(query_counts[algo], team[0]->stop());	\
+	rtime[algo] += latency / 1e9;									\
+	latencies[algo].record(latency);								\
 	acc[algo]	+= pair.first == actual_label;						\
 	af[algo]	+= pair.second / actual_distance;					\
 	maf[algo]	 = max(maf[algo], pair.second / actual_distance);	\
@@ -42,6 +51,48 @@ static const char* names[] = {"LSH ", "Cube", "GNNS", "MRNG"};
 
 using namespace std;
 
+// Counter groups of the threads of the OpenMP pool, started and read together (see -perf)
+static void start(vector<PerfGroup*>& team) {
+	for (auto group : team)
+		group->start();
+}
+
+static vector<uint64_t> stop(vector<PerfGroup*>& team) {
+	vector<uint64_t> out(EVENTS, 0);
+	for (auto group : team) {
+		auto counts = group->stop();
+		for (uint32_t e = 0; e < EVENTS; e++)
+			out[e] += counts[e];
+	}
+
+	return out;
+}
+
+static void add(vector<uint64_t>& totals, const vector<uint64_t>& counts) {
+	for (uint32_t e = 0; e < EVENTS; e++)
+		totals[e] += counts[e];
+}
+
+// Counts per operation, "n/a" for the events the kernel does not expose
+static void print(ofstream& out, const char* name, const vector<uint64_t>& counts, const PerfGroup& group, double ops) {
+	out << name << " |" << fixed << setprecision(0);
+	for (uint32_t e = 0; e < EVENTS; e++) {
+		if (group.available(e))
+			out << setw(14) << counts[e] / ops << " |";
+		else
+			out << setw(14) << "n/a" << " |";
+
+		// Instructions per cycle after the instructions
+		if (e == INSTRUCTIONS) {
+			if (group.available(CYCLES) && group.available(INSTRUCTIONS) && counts[CYCLES] > 0)
+				out << setw(6) << setprecision(2) << (double)counts[INSTRUCTIONS] / counts[CYCLES] << setprecision(0) << " |";
+			else
+				out << setw(6) << "n/a" << " |";
+		}
+	}
+	out << endl;
+}
+
 int main(int argc, const char* argv[]){
 try{
 
@@ -57,6 +108,9 @@ try{
 	parser.add("gnns_save", STRING);
 	parser.add("mrng_load", STRING);
 	parser.add("mrng_save", STRING);
+	parser.add("hnsw_load", STRING);
+	parser.add("hnsw_save", STRING);
+	parser.add("perf", BOOL, "false");
 	
 	parser.parse(argc,argv);
 	
@@ -66,6 +120,9 @@ try{
     string save_path_mrng = parser.parsed("mrng_save") ? parser.value<string>("mrng_save") : "";
     string load_path_mrng = parser.parsed("mrng_load") ? parser.value<string>("mrng_load") : "";
 
+    string save_path_hnsw = parser.parsed("hnsw_save") ? parser.value<string>("hnsw_save") : "";
+    string load_path_hnsw = parser.parsed("hnsw_load") ? parser.value<string>("hnsw_load") : "";
+
 	string data_path;
 	string query_path;
 	string out_path;
@@ -127,6 +184,9 @@ try{
 	file_parser.add("cube_k", "cube_k", 14);
 	file_parser.add("cube_M", "cube_M", 10);
 	file_parser.add("cube_probes", "cube_probes", 2);
+
+	file_parser.add("ivf_nlist", "ivf_nlist", 100);
+	file_parser.add("ivf_nprobe", "ivf_nprobe", 8);
 	
 	file_parser.add("graph_approx", "graph_approx", 1);
 	file_parser.add("graph_k", "graph_k", 50);
@@ -134,11 +194,36 @@ try{
 	file_parser.add("graph_R", "graph_T", 10);
 	file_parser.add("graph_E", "graph_E", 30);
 	file_parser.add("graph_l", "graph_l", 2);
+	file_parser.add("mrng_entries", "mrng_entries", 0);
+	file_parser.add("mrng_seeds", "mrng_seeds", 1);
+
+	file_parser.add("hnsw_M", "hnsw_M", 16);
+	file_parser.add("hnsw_efC", "hnsw_efC", 200);
+	file_parser.add("hnsw_efS", "hnsw_efS", 50);
 
 
 
 	file_parser.parse(configuration_path);
 
+	// Hardware counters: a group opened by every thread of the OpenMP pool, as the builds run in parallel.
+	// Threads outside the pool (beyond its size in a num_threads( ) region, the graph consolidation
+	// thread) are not counted. The queries run on this thread, thread 0 of the pool.
+	vector<PerfGroup*> team;
+	vector<vector<uint64_t>> build_counts(6, vector<uint64_t>(EVENTS, 0)), query_counts = build_counts;
+	if (parser.value<bool>("perf")) {
+		team.resize(omp_get_max_threads());
+
+		#pragma omp parallel
+		team[omp_get_thread_num()] = new PerfGroup(PerfGroup::hardware());
+
+		if (!team[0]->available()) {
+			cout << "Hardware counters are not available, -perf is ignored" << endl;
+			for (auto group : team)
+				delete group;
+			team.clear();
+		}
+	}
+
 
 	//////////////////////////////////
 	//////////////LSH////////////////
@@ -151,7 +236,9 @@ try{
 
 	cout << "Populating LSH HashTables... " << flush;
 	swcout.start();
+	start(team);
 	LSH lsh(train, window, lsh_k, lsh_L, table_size);
+	build_counts[_LSH] = stop(team);
 	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl; 
 
 
@@ -165,7 +252,24 @@ try{
 
 	cout << "Populating Cube HashTable... " << flush;
 	swcout.start();
+	start(team);
 	Cube cube(train, window, cube_k, cube_probes, cube_M);
+	build_counts[_CUBE] = stop(team);
+	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl;
+
+
+	//////////////////////////////////
+	//////////////IVF/////////////////
+	//////////////////////////////////
+
+	uint32_t ivf_nlist  = file_parser.value("ivf_nlist");
+	uint32_t ivf_nprobe = file_parser.value("ivf_nprobe");
+
+	cout << "Populating IVF lists... " << flush;
+	swcout.start();
+	start(team);
+	IVF ivf(train, ivf_nlist, ivf_nprobe);
+	build_counts[_IVF] = stop(team);
 	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl;
 
 
@@ -175,15 +279,25 @@ try{
 
 	uint32_t approx_id = file_parser.value("graph_approx");
 	uint32_t k = file_parser.value("graph_k");
-	uint32_t R = file_parser.value("graph_R");
-	uint32_t T = file_parser.value("graph_T");
-	uint32_t E = file_parser.value("graph_E");
-	uint32_t l = file_parser.value("graph_l");
+	uint32_t entries = file_parser.parsed("mrng_entries") ? file_parser.value("mrng_entries") : 0;
+
+	// Approximator used for the construction of GNNS and MRNG: 1 for LSH, 2 for Cube, 3 for IVF
+	Approximator* approx = approx_id == 1 ? (Approximator*)&lsh : approx_id == 3 ? (Approximator*)&ivf : (Approximator*)&cube;
+
+	// Search-time parameters, shared by all the graphs
+	SearchParams params;
+	params.R     = file_parser.value("graph_R");
+	params.T     = file_parser.value("graph_T");
+	params.E     = file_parser.value("graph_E");
+	params.L     = file_parser.value("graph_l");
+	params.seeds = file_parser.value("mrng_seeds");
+	params.ef    = file_parser.value("hnsw_efS");
 	
 	cout << "Creating GNN graph... " << flush;
     swcout.start();
-	GNNS gnns_graph = GNNS(train, approx_id == 1 ? (Approximator*)&lsh : (Approximator*)&cube,
-						  l2_distance, k, R, T, E, load_path_gnns);
+	start(team);
+	GNNS gnns_graph = GNNS(train, approx, l2_distance, k, load_path_gnns);
+	build_counts[_GNNS] = stop(team);
 	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)"<< endl; 
 
 	if (!save_path_gnns.empty()) {
@@ -199,8 +313,9 @@ try{
 
 	cout << "Creating MRNG graph... " << flush;
     swcout.start();
-	MRNG mrng_graph = MRNG(train, approx_id == 1 ? (Approximator*)&lsh : (Approximator*)&cube,
-						l2_distance, l2_distance, k, l, load_path_mrng);
+	start(team);
+	MRNG mrng_graph = MRNG(train, approx, l2_distance, l2_distance, k, entries, load_path_mrng);
+	build_counts[_MRNG] = stop(team);
 	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)"<< endl; 
 
 	if (!save_path_mrng.empty()) {
@@ -210,15 +325,40 @@ try{
         cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl; 
     }
 
+	//////////////////////////////////
+	//////////////HNSW////////////////
+	//////////////////////////////////
+
+	uint32_t hnsw_M   = file_parser.value("hnsw_M");
+	uint32_t hnsw_efC = file_parser.value("hnsw_efC");
+
+	cout << "Creating HNSW graph... " << flush;
+    swcout.start();
+	start(team);
+	HNSW hnsw_graph(train, l2_distance, hnsw_M, hnsw_efC, load_path_hnsw);
+	build_counts[_HNSW] = stop(team);
+	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)"<< endl; 
+
+	if (!save_path_hnsw.empty()) {
+        cout << "Saving HNSW graph... " << flush;
+        swcout.start();
+        hnsw_graph.save(save_path_hnsw);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl; 
+    }
+
 
 	cout << "Loading data... " << flush;
 	swcout.start();
 	DataSet test(query_path, QUERIES);
 	cout << "Done! (" << std::fixed << std::setprecision(3) << swcout.stop() << " seconds)" << endl; 
 
-	Vector<double> acc(4), rtime(4), af(4), maf(4, 1.);
+	Vector<double> acc(6), rtime(6), af(6), maf(6, 1.);
 	double bf_avg_time = 0;
 
+	// Per-query latencies, for the tail next to the averages
+	vector<Histogram> latencies(6);
+	uint64_t latency;
+
 	Stopwatch timer;
 	timer.start();
 	cout << "Beginning queries... " << flush;
@@ -236,8 +376,10 @@ try{
 		
 		METRICS(_LSH, lsh.kANN(*q, 1, l2_distance))
 		METRICS(_CUBE, cube.kANN(*q, 1, l2_distance))
-		METRICS(_GNNS, gnns_graph.query(q->data(), 1))
-		METRICS(_MRNG, mrng_graph.query(q->data(), 1))
+		METRICS(_IVF, ivf.kANN(*q, 1, l2_distance))
+		METRICS(_GNNS, gnns_graph.query(q->data(), params))
+		METRICS(_MRNG, mrng_graph.query(q->data(), params))
+		METRICS(_HNSW, hnsw_graph.query(q->data(), params))
 	}
 
 	acc   /= test.size();
@@ -257,16 +399,54 @@ try{
 	output_file << "Cube |  " 	 << acc[_CUBE] << "  |        "   << af[_CUBE] 
 				<< "        |  " << maf[_CUBE] << "  |          " << rtime[_CUBE] << endl;
 	
+	output_file << " IVF |  " 	 << acc[_IVF] << "  |        "    << af[_IVF] 
+				<< "        |  " << maf[_IVF] << "  |          " << rtime[_IVF] << endl;
+	
 	output_file << "GNNS |  " 	 << acc[_GNNS] << "  |        "   << af[_GNNS] 
 				<< "        |  " << maf[_GNNS] << "  |          " << rtime[_GNNS] << endl;
 	
 	output_file << "MRNG |  " 	 << acc[_MRNG] << "  |        "   << af[_MRNG] 
 				<< "        |  " << maf[_MRNG] << "  |          " << rtime[_MRNG] << endl;
 	
-	csv_file << "Accuracy," <<   acc[0] << "," <<   acc[1] << "," <<   acc[2] << "," <<   acc[3] << endl;
-	csv_file << "AF,"		<<    af[0] << "," <<    af[1] << "," <<    af[2] << "," <<    af[3] << endl;
-	csv_file << "MAF,"		<<   maf[0] << "," <<   maf[1] << "," <<   maf[2] << "," <<   maf[3] << endl;
-	csv_file << "RTime,"	<< rtime[0] << "," << rtime[1] << "," << rtime[2] << "," << rtime[3] << endl;
+	output_file << "HNSW |  " 	 << acc[_HNSW] << "  |        "   << af[_HNSW] 
+				<< "        |  " << maf[_HNSW] << "  |          " << rtime[_HNSW] << endl;
+	
+	output_file << endl;
+	// Per-query latency in milliseconds
+	static const char* labels[] = {" LSH", "Cube", "GNNS", "MRNG", "HNSW", " IVF"};
+	output_file << "     |   p50   |   p90   |   p99   |  p99.9  |   max   (Latency, ms)" << endl;
+	output_file << "     |---------+---------+---------+---------+---------" << endl;
+	for (uint32_t algo : { _LSH, _CUBE, _IVF, _GNNS, _MRNG, _HNSW }) {
+		auto& histogram = latencies[algo];
+		output_file << labels[algo];
+		for (double percent : { 50., 90., 99., 99.9 })
+			output_file << " | " << setw(7) << histogram.percentile(percent) / 1e6;
+		output_file << " | " << setw(7) << histogram.max() / 1e6 << endl;
+	}
+
+	if (!team.empty()) {
+		static const char* header = "|        cycles |  instructions |   IPC |    LLC misses |   dTLB misses | branch misses |";
+		static const char* rule   = "|---------------+---------------+-------+---------------+---------------+---------------+";
+
+		output_file << endl << "Hardware counters per query" << endl;
+		output_file << "     " << header << endl << "     " << rule << endl;
+		for (uint32_t algo : { _LSH, _CUBE, _IVF, _GNNS, _MRNG, _HNSW })
+			print(output_file, labels[algo], query_counts[algo], *team[0], test.size());
+
+		output_file << endl << "Hardware counters of the builds (threads of the OpenMP pool only)" << endl;
+		output_file << "     " << header << endl << "     " << rule << endl;
+		for (uint32_t algo : { _LSH, _CUBE, _IVF, _GNNS, _MRNG, _HNSW })
+			print(output_file, labels[algo], build_counts[algo], *team[0], 1);
+
+		output_file << endl;
+		for (auto group : team)
+			delete group;
+	}
+
+	csv_file << "Accuracy," <<   acc[0] << "," <<   acc[1] << "," <<   acc[2] << "," <<   acc[3] << "," <<   acc[4] << "," <<   acc[5] << endl;
+	csv_file << "AF,"		<<    af[0] << "," <<    af[1] << "," <<    af[2] << "," <<    af[3] << "," <<    af[4] << "," <<    af[5] << endl;
+	csv_file << "MAF,"		<<   maf[0] << "," <<   maf[1] << "," <<   maf[2] << "," <<   maf[3] << "," <<   maf[4] << "," <<   maf[5] << endl;
+	csv_file << "RTime,"	<< rtime[0] << "," << rtime[1] << "," << rtime[2] << "," << rtime[3] << "," << rtime[4] << "," << rtime[5] << endl;
 
 }
 catch (exception& e){
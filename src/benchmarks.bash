@@ -17,8 +17,9 @@ sizes=(100 500 1000 2000 5000 10000 20000 30000 40000 60000)
 
 gnns_prefix="./graphs/graph_gnns_"
 mrng_prefix="./graphs/graph_mrng_"
+hnsw_prefix="./graphs/graph_hnsw_"
 
-echo "Metric,LSH,Cube,GNNS,MRNG" > "$csv_file"
+echo "Metric,LSH,Cube,GNNS,MRNG,HNSW,IVF" > "$csv_file"
 
 make -s benchmark
 
@@ -26,6 +27,7 @@ for size in "${sizes[@]}"; do
     output_file="${output_prefix}${size}.txt"
     gnns_file="${gnns_prefix}${size}.csv"
     mrng_file="${mrng_prefix}${size}.csv"
+    hnsw_file="${hnsw_prefix}${size}.csv"
 
     if [ -e "$gnns_file" ]; then
         gnns="-gnns_load"
@@ -39,6 +41,12 @@ for size in "${sizes[@]}"; do
         mrng="-mrng_save"
     fi
 
+    if [ -e "$hnsw_file" ]; then
+        hnsw="-hnsw_load"
+    else
+        hnsw="-hnsw_save"
+    fi
+
     ./benchmark \
         -d "$train_images" \
         -q "$test_images" \
@@ -47,7 +55,8 @@ for size in "${sizes[@]}"; do
         -config "$config_file" \
         -size "$size" \
         "$gnns" "$gnns_file" \
-        "$mrng" "$mrng_file" 
+        "$mrng" "$mrng_file" \
+        "$hnsw" "$hnsw_file"
 done
 
 if [ "$#" -lt 2 ]; then
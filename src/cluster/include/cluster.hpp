@@ -1,33 +1,52 @@
 #pragma once
 #include <vector>
-#include <set>
+#include <cstdint>
 #include "Vector.hpp"
 #include "utils.hpp"
 #include "Approximator.hpp"
+#include "PQ.hpp"
+#include "ClusterModel.hpp"
 
 
+// Running sum and size of the members of a cluster. Membership itself is kept by the Clusterer, as
+// the cluster of every point; the list of members is only filled by Clusterer::get( ), for output.
 class Cluster {
 	private:
 		Vector<double>* center_;
-		std::set<DataPoint*> points_;
+		std::vector<uint64_t> sum_;
+		uint32_t size_;
+		std::vector<DataPoint*> points_;
 
 	public:
-		Cluster(uint32_t size) : center_(new Vector<double>(size)) { }
-		Cluster(DataPoint* point) : center_(new Vector<double>(point->data())) { }
+		Cluster(uint32_t size) : center_(new Vector<double>(size)), sum_(size, 0), size_(0) { }
+		Cluster(DataPoint* point) : center_(new Vector<double>(point->data())), sum_(point->data().len(), 0), size_(0) { }
 		~Cluster() { delete center_; }
-        void projectToDataset(DataSet& new_dataset);
-
-        double ObjectiveFunctionValue(Distance<uint8_t, double> dist);
 
-		uint32_t size() const { return points_.size(); }
+		uint32_t size() const { return size_; }
 		void add(DataPoint* point);
 		void remove(DataPoint* point);
-		std::set<DataPoint*>& points() { return points_; }
+		void set(const uint64_t* sum, uint32_t size);
+		std::vector<DataPoint*>& points() { return points_; }
 		Vector<double>& center() { return *center_; }
-        void update(uint32_t new_size);
-        void clear() { points_.clear(); }
+        void update();
+        void clear(uint32_t dim=0);
 };
 
+// Initial centers. KMEANSPP draws the k centers one at a time, each a pass over the dataset.
+// KMEANSPARALLEL (k-means||) oversamples a few rounds of candidates in parallel and runs
+// weighted k-means++ over them, fewer passes for large k.
+typedef enum { KMEANSPP, KMEANSPARALLEL } Seeding;
+
+// Silhouette of every cluster and of the whole clustering. The margins are the half-widths of 95%
+// confidence intervals, zero when every point is evaluated.
+typedef struct {
+    std::vector<double> clusters, margins;
+    double total, margin;
+} Silhouettes;
+
+// Cluster of the points that are not assigned yet
+#define UNASSIGNED UINT32_MAX
+
 class Clusterer {
     protected:
         DataSet* dataset;
@@ -35,25 +54,68 @@ class Clusterer {
 		Distance<uint8_t, double> dist;
 
 		std::vector<Cluster*> clusters;
+		std::vector<uint32_t> assignment;   // Cluster of every point, by label
+
+		std::pair<double, uint32_t> closest(DataPoint* point);
+		void accumulate();
 
-		std::pair<double, Cluster*> closest(DataPoint* point);
+		// Indexes of the points grouped by cluster, those of cluster j in order[offsets[j]..offsets[j + 1])
+		void group(std::vector<uint32_t>& offsets, std::vector<uint32_t>& order) const;
     public:
-        Clusterer(DataSet& dataset, uint32_t k, Distance<uint8_t, double> dist);
+        Clusterer(DataSet& dataset, uint32_t k, Distance<uint8_t, double> dist, Seeding seeding=KMEANSPP);
         virtual ~Clusterer();
         void projectToDataset(DataSet& new_dataset);
         void clear();
         std::vector<Cluster*>& get();
-        std::pair<std::vector<double>, double> silhouettes(Distance<uint8_t, uint8_t> dist);
+        Silhouettes silhouettes(Distance<uint8_t, uint8_t> dist, uint32_t sample=0);
         double ObjectiveFunctionValue(Distance<uint8_t,double> dist);
+        ClusterModel* model() const;
         virtual void apply() = 0;
 };
 
+// MACQUEEN moves a point as soon as a closer center is found, updating both centers. BATCH assigns
+// every point in parallel, then recomputes the centers from per-thread partial sums, skipping most
+// distances with Hamerly's bounds. Batch updates compute Euclidean distances and require l2_distance.
+typedef enum { MACQUEEN, BATCH } Update;
+
 class Lloyd : public Clusterer {
     private:
+        Update update;
+        uint32_t iterations_;
 
+        void macqueen();
+        void batch();
     public:
-        Lloyd(DataSet& dataset, uint32_t k, Distance<uint8_t, double> dist);
+        Lloyd(DataSet& dataset, uint32_t k, Distance<uint8_t, double> dist, Update update=MACQUEEN, Seeding seeding=KMEANSPP);
         void apply() override;
+        uint32_t iterations() const;
+};
+
+// Mini-batch k-means (Sculley): points are read from a stream in batches, every batch is assigned to the
+// closest centers in parallel, and each center moves to the weighted mean of its previous position and its
+// new points, with a learning rate of 1 / (points it has received). The initial centers are picked by
+// k-means++ (or k-means||) among a reservoir sample, drawn in one pass over the stream, so only the sample
+// and a batch are ever held in memory. Memberships are left to the model, see ClusterModel::assign( ).
+// Distances are Euclidean.
+class MiniBatchKMeans {
+    private:
+        DataStream& stream;
+        uint32_t batch;
+        uint32_t passes;
+        std::vector<float> centers;
+        std::vector<uint64_t> counts;   // Points received by every center
+    public:
+        MiniBatchKMeans(DataStream& stream, uint32_t k, uint32_t batch=1024, uint32_t passes=3, 
+                        uint32_t sample=16384, Seeding seeding=KMEANSPP);
+
+        // Updates the centers with a batch of count points of stream.dim( ) bytes each, such as new data
+        // for a trained model. apply( ) feeds the whole stream, batch by batch, "passes" times.
+        void feed(const uint8_t* points, uint32_t count);
+        void apply();
+        uint64_t seen() const;
+
+        // Final centers, with the sizes of the clusters if they are known
+        ClusterModel* model(const std::vector<uint32_t>& sizes={}) const;
 };
 
 class RAssignment : public Clusterer {
@@ -64,7 +126,11 @@ class RAssignment : public Clusterer {
     public:
         RAssignment(DataSet& dataset, uint32_t k, Approximator* approx,
                     Distance<uint8_t, double> dist1, 
-		            Distance<double, double>  dist2); 
+		            Distance<double, double>  dist2,
+                    Seeding seeding=KMEANSPP); 
         ~RAssignment();
         void apply() override;
-};
\ No newline at end of file
+};
+
+// Product quantizer with one Lloyd codebook per sub-space, trained on a random sample of the dataset
+PQ* train_pq(DataSet& dataset, uint32_t m, uint32_t ksub=256, uint32_t sample=4096);
\ No newline at end of file
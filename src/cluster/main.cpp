@@ -24,6 +24,11 @@ try {
     arg_parser.add("c", STRING);
     arg_parser.add("o", STRING);
     arg_parser.add("complete", BOOL, "false");
+    arg_parser.add("macqueen", BOOL, "false");
+    arg_parser.add("oversample", BOOL, "false");
+    arg_parser.add("sample", UINT, "0");
+    arg_parser.add("model", STRING);
+    arg_parser.add("assign", STRING);
     arg_parser.add("project", STRING);
     arg_parser.add("m", STRING);
     arg_parser.parse(argc, argv);
@@ -43,6 +48,10 @@ try {
     file_parser.add("max_number_M_hypercube",          "M",      10);
     file_parser.add("number_of_hypercube_dimensions",  "cube_k", 14);
     file_parser.add("number_of_probes",                "probes",  2);
+    file_parser.add("number_of_pivots",                "pivots", 16);
+    file_parser.add("mini_batch_size",                 "batch", 1024);
+    file_parser.add("mini_batch_passes",               "passes",   3);
+    file_parser.add("mini_batch_seeding_sample",       "reservoir", 16384);
 
     if(arg_parser.parsed("i"))
         input_path = arg_parser.value<string>("i");
@@ -52,6 +61,55 @@ try {
     }
 
 
+    // Assignment mode: the points of the input file are streamed and labeled by the closest centroid of a saved model
+    if(arg_parser.parsed("assign")) {
+        if(arg_parser.parsed("o"))
+            out_path = arg_parser.value<string>("o");
+        else {
+            cout << "Enter path to output file: " << flush;
+            getline(cin, out_path);
+        }
+
+        cout << "Loading cluster model... " << flush;
+        timer.start();
+        ClusterModel model(arg_parser.value<string>("assign"));
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+
+        DataStream stream(input_path);
+        if (stream.dim() != model.dim())
+            throw runtime_error("Dimensions of the model and the input file must match!\n");
+
+        ofstream output_file(out_path, ios::out);
+        if (output_file.fail()) 
+            throw runtime_error(out_path + " could not be opened!\n");
+
+        cout << "Assigning points to clusters... " << flush;
+        timer.start();
+
+        // One line per point, with its cluster
+        const uint32_t batch = 65536;
+        vector<uint8_t> buffer((size_t)batch * stream.dim());
+        vector<uint32_t> assigned(batch);
+        string lines;
+        uint32_t count;
+
+        while ((count = stream.read(buffer.data(), batch)) > 0) {
+            model.assign(buffer.data(), count, assigned.data());
+
+            lines.clear();
+            for (uint32_t i = 0; i < count; i++)
+                lines += to_string(assigned[i] + 1) + '\n';
+
+            output_file << lines;
+        }
+
+        double assign_time = timer.stop();
+        cout << "Done! (" << std::fixed << std::setprecision(3) << assign_time << " seconds, " 
+             << (uint32_t)(stream.size() / assign_time) << " points per second)" << endl;
+
+        return 0;
+    }
+
     if(arg_parser.parsed("c"))
         configuration_path = arg_parser.value<string>("c");
     else {
@@ -71,8 +129,8 @@ try {
     else{
         cout << "Enter approximator method: " << flush;
         getline(cin, approx_method);
-        if(approx_method != "Classic" && approx_method != "LSH" && approx_method != "Hypercube")
-            throw runtime_error("Invalid Approximator Method: Valid options are 'Classic', 'LSH' and 'Hypercube'");
+        if(approx_method != "Classic" && approx_method != "LSH" && approx_method != "Hypercube" && approx_method != "Pivots" && approx_method != "MiniBatch")
+            throw runtime_error("Invalid Approximator Method: Valid options are 'Classic', 'LSH', 'Hypercube', 'Pivots' and 'MiniBatch'");
     }
 
     
@@ -81,6 +139,9 @@ try {
     uint32_t k = file_parser.parsed("k") ? file_parser.value("k") : 0, L = file_parser.value("L");
     uint32_t lsh_k = file_parser.value("lsh_k"), M = file_parser.value("M");
     uint32_t cube_k = file_parser.value("cube_k"), probes = file_parser.value("probes");
+    uint32_t pivot_count = file_parser.value("pivots");
+    uint32_t batch = file_parser.value("batch"), passes = file_parser.value("passes");
+    uint32_t reservoir = file_parser.value("reservoir");
     
 
     if(k == 0) {
@@ -95,6 +156,95 @@ try {
     if (output_file.fail()) 
         throw runtime_error(out_path + " could not be opened!\n");
 
+    Seeding seeding = arg_parser.value<bool>("oversample") ? KMEANSPARALLEL : KMEANSPP;
+
+    // Mini-batch k-means never loads the input file: it is streamed for seeding, for every pass and for the labels
+    if (approx_method == "MiniBatch") {
+        if (arg_parser.parsed("project"))
+            throw runtime_error("Projection needs the whole dataset, it is not supported with 'MiniBatch'!\n");
+
+        DataStream stream(input_path);
+
+        cout << "Selecting initial cluster centers... " << flush;
+        timer.start();
+        MiniBatchKMeans clusterer(stream, k, batch, passes, reservoir, seeding);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)"<< endl; 
+
+        cout << "Applying " << approx_method << " clustering algorithm... "<< flush;
+        timer.start();
+        clusterer.apply();
+        double clustering_time = timer.stop();
+        cout << "Done! (" << std::fixed << std::setprecision(3) << clustering_time << " seconds, " 
+             << clusterer.seen() << " points streamed)" << endl; 
+
+        // A first pass for the sizes and the objective function, a second one for the labels
+        ClusterModel* model = clusterer.model();
+        const uint32_t assigned_batch = 65536;
+        vector<uint8_t> buffer((size_t)assigned_batch * stream.dim());
+        vector<uint32_t> assigned(assigned_batch);
+        vector<float> distances(assigned_batch);
+        vector<uint32_t> sizes(model->size(), 0);
+        double error = 0;
+        uint32_t count;
+
+        cout << "Calculating the Objective Function (l2) value... " << flush;
+        timer.start();
+        stream.rewind();
+        while ((count = stream.read(buffer.data(), assigned_batch)) > 0) {
+            model->assign(buffer.data(), count, assigned.data(), distances.data());
+
+            for (uint32_t i = 0; i < count; i++) {
+                sizes[assigned[i]]++;
+                error += distances[i];
+            }
+        }
+        error /= stream.size();
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+
+        output_file << "Algorithm: Mini-batch K-Means\n";
+        for (uint32_t j = 0; j < model->size(); j++) {
+            Vector<double> center(stream.dim());
+            for (uint32_t d = 0; d < stream.dim(); d++)
+                center[d] = model->centroid(j)[d];
+
+            output_file << "CLUSTER-" << left << setw(3) << to_string(j + 1);
+            output_file << "{size: " << right << setw(5) << to_string(sizes[j]);
+            output_file << ", centroid: " << center.asString();
+            output_file << "}\n";
+        }
+
+        output_file << "clustering_time: ";
+        output_file <<  std::fixed << std::setprecision(3) << clustering_time << " sec\n";
+        output_file << "Objective Function value: "<< std::setprecision(3) << error << "\n\n";
+
+        // One line per point, with its cluster, as in assignment mode
+        cout << "Assigning points to clusters... " << flush;
+        timer.start();
+        output_file << "Labels:\n";
+        string lines;
+
+        stream.rewind();
+        while ((count = stream.read(buffer.data(), assigned_batch)) > 0) {
+            model->assign(buffer.data(), count, assigned.data());
+
+            lines.clear();
+            for (uint32_t i = 0; i < count; i++)
+                lines += to_string(assigned[i] + 1) + '\n';
+
+            output_file << lines;
+        }
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+
+        if (arg_parser.parsed("model")) {
+            ClusterModel* sized = clusterer.model(sizes);
+            sized->save(arg_parser.value<string>("model"));
+            delete sized;
+        }
+
+        delete model;
+        return 0;
+    }
+
     cout << "Loading input data... " << flush;
     timer.start();
     DataSet dataset(input_path);
@@ -114,17 +264,32 @@ try {
 
     uint32_t window = 2600;
     uint32_t table_size = dataset.size() / 8;
-    
+
+    // Exact reverse assignment: range searches over the whole dataset, pruned with a pivot table
+    Pivots* pivots = nullptr;
+    Approximator* exact = nullptr;
+    if (approx_method == "Pivots") {
+        cout << "Computing pivot table (" << pivot_count << " pivots)... " << flush;
+        timer.start();
+        pivots = new Pivots(dataset, pivot_count);
+        exact = new Approximator(dataset);
+        exact->prune(pivots);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+    }
+
+
     cout << "Selecting initial cluster centers... " << flush;
     timer.start();
     Clusterer* clusterer = 
     approx_method == "Classic" ? 
-        (Clusterer*)new Lloyd(dataset, k, l2_distance) :
+        (Clusterer*)new Lloyd(dataset, k, l2_distance, arg_parser.value<bool>("macqueen") ? MACQUEEN : BATCH, seeding) :
         (Clusterer*)new RAssignment(dataset, k, 
                                     approx_method == "LSH" ? 
                                         (Approximator*)new LSH(dataset, window, lsh_k, L, table_size) : 
+                                    approx_method == "Pivots" ?
+                                        exact :
                                         (Approximator*)new Cube(dataset, window, cube_k, probes, M), 
-                                    l2_distance, l2_distance);
+                                    l2_distance, l2_distance, seeding);
     cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)"<< endl; 
     
     
@@ -132,7 +297,22 @@ try {
     timer.start();
     clusterer->apply();
     double clustering_time = timer.stop();
-    cout << "Done! (" << std::fixed << std::setprecision(3) << clustering_time << " seconds)"<< endl; 
+    cout << "Done! (" << std::fixed << std::setprecision(3) << clustering_time << " seconds";
+    if (approx_method == "Classic") {
+        uint32_t iterations = ((Lloyd*)clusterer)->iterations();
+        cout << ", " << iterations << " iterations, " << clustering_time / iterations << " per iteration";
+    }
+    cout << ")" << endl; 
+
+    if (arg_parser.parsed("model")) {
+        ClusterModel* model = clusterer->model();
+        model->save(arg_parser.value<string>("model"));
+        delete model;
+    }
+
+    if (pivots)
+        cout << "Distances skipped by the pivot table: " << std::fixed << std::setprecision(2) 
+             << 100 * pivots->rate() << "%" << endl;
 
     if(arg_parser.parsed("project")){
         cout << "Projecting to dataset... " << flush;
@@ -147,7 +327,7 @@ try {
     output_file << '\n';
 
     auto clusters = clusterer->get();
-    for(uint32_t i = 0; i < k; i++){
+    for(uint32_t i = 0; i < clusters.size(); i++){
         output_file << "CLUSTER-" << left << setw(3) << to_string(i + 1);
         output_file << "{size: " << right << setw(5) << to_string(clusters[i]->size());
         output_file << ", centroid: " << clusters[i]->center().asString();
@@ -158,9 +338,12 @@ try {
     output_file <<  std::fixed << std::setprecision(3) << clustering_time << " sec\n";
 
 
+    // Exact unless a sample size is given
+    uint32_t sample = arg_parser.value<uint32_t>("sample");
+
     cout << "Evaluating the Silhouette coefficient... " << flush;
     timer.start();
-    auto p = clusterer->silhouettes(l2_distance);
+    auto p = clusterer->silhouettes(l2_distance, sample);
     cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
 
     cout << "Calculating the Objective Function (l2) value... " << flush;
@@ -169,8 +352,8 @@ try {
     cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
         
 
-    auto silhouettes = p.first;
-    auto stotal = p.second;
+    auto silhouettes = p.clusters;
+    auto stotal = p.total;
 
 
     output_file << "Silhouette: [";
@@ -179,11 +362,19 @@ try {
 
     output_file << std::fixed << std::setprecision(3) << stotal << "]\n";
 
+    if (sample > 0) {
+        output_file << "Silhouette 95% margin: [";
+        for (auto margin : p.margins)
+            output_file << std::fixed << std::setprecision(3) << margin << ", ";
+
+        output_file << std::fixed << std::setprecision(3) << p.margin << "]\n";
+    }
+
     output_file << "Objective Function value: "<< std::setprecision(3) << error << "\n\n";
 
 
     if (arg_parser.value<bool>("complete")) {
-        for(uint32_t i = 0; i < k; i++){
+        for(uint32_t i = 0; i < clusters.size(); i++){
             output_file << "CLUSTER-" << left << setw(3) << to_string(i + 1);
             output_file << "{centroid, ";
 
@@ -201,6 +392,7 @@ try {
     }
 
     delete clusterer;
+    delete pivots;
     if(projection_dataset)
         delete projection_dataset;
 } 
@@ -2,6 +2,14 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <cfloat>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cstring>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -9,146 +17,188 @@ using namespace std;
 // Cluster //
 /////////////
 
-// Update cluster center
-void Cluster::update(uint32_t new_size = 0) {
-	if (points_.size() == 0)
+// Center from the running sum, empty clusters keep their center
+void Cluster::update() {
+	if (size_ == 0)
 		return ;
 
-	if(new_size == 0)
-		new_size = center_->len();
-
-	auto sum = new Vector<uint32_t>(new_size);
+	for (uint32_t d = 0; d < sum_.size(); d++)
+		(*center_)[d] = (double)sum_[d] / size_;
+}
 
-	// Compute average vector
-	for (auto point : points_)
-		*sum += point->data();
-	
-	delete center_;
-	center_ = new Vector<double>(*sum);
-	*center_ /= (double)points_.size();
+void Cluster::add(DataPoint* point) {
+	auto& vector = point->data();
+	for (uint32_t d = 0; d < sum_.size(); d++)
+		sum_[d] += vector[d];
 
-	delete sum;
+	size_++;
 }
 
-void Cluster::add(DataPoint* point) {
+void Cluster::remove(DataPoint* point) {
+	auto& vector = point->data();
+	for (uint32_t d = 0; d < sum_.size(); d++)
+		sum_[d] -= vector[d];
 
-	// Quickly find sum of all vectors
-	*center_ *= (double)points_.size();
+	size_--;
+}
 
-	points_.insert(point);
-	*center_ += point->data();
+void Cluster::set(const uint64_t* sum, uint32_t size) {
+	copy_n(sum, sum_.size(), sum_.begin());
+	size_ = size;
+}
 
-	// Recompute average
-	*center_ /= (double)points_.size();
+// No members, a non-zero "dim" changes the dimension (and clears the center)
+void Cluster::clear(uint32_t dim) {
+	if (dim != 0 && dim != sum_.size()) {
+		delete center_;
+		center_ = new Vector<double>(dim);
+	}
 
+	sum_.assign(dim == 0 ? sum_.size() : dim, 0);
+	size_ = 0;
+	points_.clear();
 }
 
-void Cluster::remove(DataPoint* point) {
+///////////////
+// Clusterer //
+///////////////
 
-	// Corner Case
-	if (points_.size() == 1) {
-		points_.erase(point);
-		*center_ *= 0;
-		return ;
-	}
-	
-	// Sum of vectors
-	*center_ *= (double)points_.size();
+// k-means|| rounds, and centers sampled per round as a multiple of k
+#define ROUNDS 5
+#define OVERSAMPLING 2
 
-	points_.erase(point);
-	*center_ -= point->data();
+// Draws an index with probability proportional to its mass, "sum" being the total mass
+static uint32_t draw(const vector<double>& mass, double sum, mt19937& generator) {
+	double target = uniform_real_distribution<double>(0, sum)(generator);
+	double accum = 0;
+	uint32_t last = 0;
 
-	// Recompute Average
-	*center_ /= (double)points_.size();
-}
+	for (uint32_t i = 0; i < mass.size(); i++) {
+		if (mass[i] <= 0)
+			continue;
 
-double Cluster::ObjectiveFunctionValue(Distance<uint8_t, double> dist){
-	
-	double error = 0;
-	
-	for(auto point : points_)
-		error += dist(point->data(), *center_);
-	
-	error /= points_.size();
+		accum += mass[i];
+		last = i;
 
-	return error;
+		if (target < accum)
+			break;
+	}
+
+	return last;
 }
 
-void Cluster::projectToDataset(DataSet& new_dataset){
-	set<DataPoint*> new_points;
+// Weighted k-means++ over the points "indexes" of the dataset: every center is drawn with probability
+// proportional to w(i) * D(i)^2, where D(i) is kept up to date against the last center only.
+// Returns fewer than k centers if every point coincides with one of them.
+static vector<uint32_t> kmeanspp(DataSet& dataset, const vector<uint32_t>& indexes, const vector<double>& weights,
+								 uint32_t k, Distance<uint8_t, double> dist, mt19937& generator) {
+	uint32_t n = indexes.size();
+	vector<double> nearest(n, DBL_MAX);
+	vector<double> mass(weights);
+	vector<uint32_t> out;
 
-	for(auto point : points_){
-		DataPoint* new_point = new_dataset[point->label()-1]; 
-		new_points.insert(new_point);
+	double sum = 0;
+	for (auto weight : weights)
+		sum += weight;
+
+	while (out.size() < k && sum > 0) {
+		uint32_t next = draw(mass, sum, generator);
+		out.push_back(indexes[next]);
+
+		Vector<double> center(dataset[indexes[next]]->data());
+		sum = 0;
+
+		#pragma omp parallel for schedule(static) reduction(+:sum)
+		for (uint32_t i = 0; i < n; i++) {
+			double distance = dist(dataset[indexes[i]]->data(), center);
+			nearest[i] = min(nearest[i], distance * distance);
+			mass[i] = weights[i] * nearest[i];
+			sum += mass[i];
+		}
 	}
-	points_ = new_points;
 
-	update(new_dataset.dim());
+	return out;
 }
 
-///////////////
-// Clusterer //
-///////////////
+// k-means|| (Bahmani et al.): every round samples each point independently with probability
+// OVERSAMPLING * k * D(i)^2 / sum(D^2), for O(ROUNDS * k) candidates in a few passes over the data.
+// Candidates are weighted by the number of points closest to them.
+static vector<uint32_t> oversample(DataSet& dataset, uint32_t k, Distance<uint8_t, double> dist,
+								   mt19937& generator, vector<double>& weights) {
+	uint32_t n = dataset.size();
+	vector<double> nearest(n, DBL_MAX);
+	vector<uint32_t> owner(n);
 
-Clusterer::Clusterer(DataSet& dataset_, uint32_t k_, Distance<uint8_t, double> dist_) 
-: dataset(&dataset_), k(k_), dist(dist_) { 
-    
-    bool* chosen = new bool[dataset->size()]();
+	vector<uint32_t> candidates = { uniform_int_distribution<uint32_t>(0, n - 1)(generator) };
+	uniform_real_distribution<double> uniform(0, 1);
+	uint32_t added = 0;
 
-    // Random point as initial center
-	uint32_t init_center = Vector<uint32_t>(1, UNIFORM, 0, dataset->size() - 1)[0];
+	for (uint32_t round = 0; ; round++) {
 
-	clusters.push_back(new Cluster((*dataset)[init_center]));
-	chosen[init_center] = true;
-	
-	// Finding rest k - 1 centers
-	for (uint32_t j = 1; j < k; j++) {
-		
-		// Stores (i, D(i) * D(i))
-		vector<PAIR> distances;
-		
-		// Probability distribution of points - candidate centers
-		vector<PAIR> probs;
+		// D(i) against the candidates of the last round only
+		vector<Vector<double>*> centers;
+		for (uint32_t c = added; c < candidates.size(); c++)
+			centers.push_back(new Vector<double>(dataset[candidates[c]]->data()));
 
-		double sum = 0; // -> sum(D(i) * D(i))
+		double sum = 0;
 
-		for (uint32_t i = 0; i < dataset->size(); i++) {
-			if (chosen[i])
-				continue;
-			
-			auto p = closest((*dataset)[i]);
-			double distance = p.first; // = D(i)
+		#pragma omp parallel for schedule(static) reduction(+:sum)
+		for (uint32_t i = 0; i < n; i++) {
+			for (uint32_t c = 0; c < centers.size(); c++) {
+				double distance = dist(dataset[i]->data(), *centers[c]);
 
-			distances.push_back(pair(i, distance*distance));
-			sum += distance*distance;
+				if (distance * distance < nearest[i]) {
+					nearest[i] = distance * distance;
+					owner[i] = added + c;
+				}
+			}
+
+			sum += nearest[i];
 		}
 
-		// Calculate distribution
-		for (auto p : distances) 
-			probs.push_back(pair(p.first, p.second / sum));
+		for (auto center : centers)
+			delete center;
 
-		// Select new center according to distribution:
+		added = candidates.size();
+		if (round == ROUNDS || sum == 0)
+			break;
 
-		// Random number, Uniform(0, 1)
-		double prob = Vector<float>(1, UNIFORM, 0, 1)[0];
+		double factor = (double)OVERSAMPLING * k / sum;
+		for (uint32_t i = 0; i < n; i++) {
+			if (nearest[i] > 0 && uniform(generator) < factor * nearest[i])
+				candidates.push_back(i);
+		}
+	}
 
-		// Probability accumulator
-		double accum = 0;
+	weights.assign(candidates.size(), 0);
+	for (uint32_t i = 0; i < n; i++)
+		weights[owner[i]]++;
 
-		for (auto p : probs) {
-			accum += p.second;
+	return candidates;
+}
 
-			if (prob > accum)
-				continue;
-			
-			// If prob <= accum, select this point
-			clusters.push_back(new Cluster((*dataset)[p.first]));
-			chosen[p.first] = true;
-			break;
-		}
+Clusterer::Clusterer(DataSet& dataset_, uint32_t k_, Distance<uint8_t, double> dist_, Seeding seeding) 
+: dataset(&dataset_), k(k_), dist(dist_), assignment(dataset_.size(), UNASSIGNED) { 
+
+	if (dataset->size() == 0)
+		throw runtime_error("Exception in Clusterer creation: Empty dataset!\n");
+
+	mt19937 generator(random_device{}());
+	vector<uint32_t> indexes;
+	vector<double> weights;
+
+	if (seeding == KMEANSPARALLEL)
+		indexes = oversample(*dataset, k, dist, generator, weights);
+	else {
+		indexes.resize(dataset->size());
+		for (uint32_t i = 0; i < indexes.size(); i++)
+			indexes[i] = i;
+
+		weights.assign(indexes.size(), 1);
 	}
 
-	delete [] chosen;
+	for (auto index : kmeanspp(*dataset, indexes, weights, k, dist, generator))
+		clusters.push_back(new Cluster((*dataset)[index]));
 }
 
 Clusterer::~Clusterer() {
@@ -157,89 +207,253 @@ Clusterer::~Clusterer() {
 }
 
 void Clusterer::clear() {
+	fill(assignment.begin(), assignment.end(), UNASSIGNED);
 	for (auto cluster : clusters)
 		cluster->clear();
 }
 
+// Sizes and sums of the clusters from the assignment, reduced from per-thread partial sums
+void Clusterer::accumulate() {
+	uint32_t K = clusters.size(), dim = dataset->dim();
+	vector<uint64_t> sums((size_t)K * dim, 0), sizes(K, 0);
+
+	#pragma omp parallel
+	{
+		vector<uint64_t> partial((size_t)K * dim, 0), counts(K, 0);
+
+		#pragma omp for schedule(static) nowait
+		for (uint32_t i = 0; i < assignment.size(); i++) {
+			if (assignment[i] == UNASSIGNED)
+				continue;
+
+			const uint8_t* x = (*dataset)[i]->data().get();
+			uint64_t* sum = partial.data() + (size_t)assignment[i] * dim;
+
+			for (uint32_t d = 0; d < dim; d++)
+				sum[d] += x[d];
+
+			counts[assignment[i]]++;
+		}
+
+		#pragma omp critical
+		{
+			for (size_t v = 0; v < sums.size(); v++)
+				sums[v] += partial[v];
+
+			for (uint32_t j = 0; j < K; j++)
+				sizes[j] += counts[j];
+		}
+	}
+
+	for (uint32_t j = 0; j < K; j++)
+		clusters[j]->set(sums.data() + (size_t)j * dim, sizes[j]);
+}
+
+// Counting sort, points keep their label order within a cluster
+void Clusterer::group(vector<uint32_t>& offsets, vector<uint32_t>& order) const {
+	offsets.assign(clusters.size() + 1, 0);
+	for (auto cluster : assignment) {
+		if (cluster != UNASSIGNED)
+			offsets[cluster + 1]++;
+	}
+
+	for (uint32_t j = 0; j < clusters.size(); j++)
+		offsets[j + 1] += offsets[j];
+
+	vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	order.resize(offsets.back());
+	for (uint32_t i = 0; i < assignment.size(); i++) {
+		if (assignment[i] != UNASSIGNED)
+			order[next[assignment[i]]++] = i;
+	}
+}
+
 
 // Find closest center to point
-pair<double, Cluster*> Clusterer::closest(DataPoint* point) {
+pair<double, uint32_t> Clusterer::closest(DataPoint* point) {
 
 	if (clusters.size() == 0)
         throw runtime_error("Exception in min_dist: Zero clusters present!\n");
 
 	double min = DBL_MAX;
-	Cluster* closest = nullptr;
+	uint32_t closest = 0;
 
-	for (auto cluster : clusters) {
-		double distance = dist(point->data(), cluster->center());
+	for (uint32_t j = 0; j < clusters.size(); j++) {
+		double distance = dist(point->data(), clusters[j]->center());
 
 		if (distance < min) {
 			min = distance;
-			closest = cluster;
+			closest = j;
 		}
 	}
 
 	return pair(min, closest);
 }
 
-std::vector<Cluster*>& Clusterer::get() { return clusters; }
+// Fills the member lists of the clusters
+std::vector<Cluster*>& Clusterer::get() {
+	vector<uint32_t> offsets, order;
+	group(offsets, order);
 
-double average_distance(DataPoint* point, Cluster* cluster, Distance<uint8_t, uint8_t> dist_) {
-	double sum = 0;
-	size_t count = 0;
+	for (uint32_t j = 0; j < clusters.size(); j++) {
+		auto& points = clusters[j]->points();
+		points.clear();
 
-	for (auto point2 : cluster->points()) {
-		if (point == point2)
-			continue;
-		
-		sum += dist_(point->data(), point2->data());
-		count++;
+		for (uint32_t p = offsets[j]; p < offsets[j + 1]; p++)
+			points.push_back((*dataset)[order[p]]);
 	}
 
-	return sum / count;
-
+	return clusters;
 }
 
-pair<vector<double>, double> Clusterer::silhouettes(Distance<uint8_t, uint8_t> dist_) {
-	vector<double> metr;
-	double stotal = 0;
+// Points of a cluster evaluated together, and members scanned per pass over them
+#define TILE 16
+#define BLOCK 256
+
+// s(i) = (b - a) / max(a, b), with "a" the average distance of point i to the rest of its cluster and "b"
+// the average distance to the cluster with the closest center. The members of every cluster are copied
+// contiguously, and tiles of points with the same two clusters scan them block by block, in parallel.
+// With a sample, about "sample" points are evaluated, stratified by cluster: every cluster is estimated
+// from its share of the sample (at least 2 points), and the total is the size-weighted average.
+Silhouettes Clusterer::silhouettes(Distance<uint8_t, uint8_t> dist_, uint32_t sample) {
+	uint32_t K = clusters.size();
+	Silhouettes out = { vector<double>(K, 0), vector<double>(K, 0), 0, 0 };
+
+	vector<uint32_t> offsets, order;
+	group(offsets, order);
+
+	uint32_t n = offsets[K], dim = dataset->dim();
+	if (n == 0)
+		return out;
+
+	uint8_t* storage = new uint8_t[(size_t)n * dim];
+	vector<Vector<uint8_t>*> entries(n);
+	vector<uint32_t> owner(n);
+
+	for (uint32_t i = 0; i < n; i++) {
+		entries[i] = new Vector<uint8_t>((*dataset)[order[i]]->data());
+		entries[i]->relocate(storage + (size_t)i * dim);
+		owner[i] = assignment[order[i]];
+	}
+
+	// Non-empty cluster with the closest center, other than the own one (K if there is none)
+	vector<uint32_t> neighbor(n, K);
 
-	for (auto cluster : clusters) {
-		
-		double sum = 0.;
+	#pragma omp parallel for schedule(static)
+	for (uint32_t i = 0; i < n; i++) {
+		double min = DBL_MAX;
+		for (uint32_t j = 0; j < K; j++) {
+			if (j == owner[i] || clusters[j]->size() == 0)
+				continue;
+
+			double distance = dist(*entries[i], clusters[j]->center());
+			if (distance < min) {
+				min = distance;
+				neighbor[i] = j;
+			}
+		}
+	}
+
+	// Points evaluated, grouped by cluster and by neighbor
+	mt19937 generator(random_device{}());
+	vector<uint32_t> chosen, counts(K, 0);
+
+	for (uint32_t j = 0; j < K; j++) {
+		uint32_t size = offsets[j + 1] - offsets[j];
+		uint32_t count = sample == 0 ? size : min(size, max(2u, (uint32_t)round((double)sample * size / n)));
+
+		vector<uint32_t> members(size);
+		for (uint32_t m = 0; m < size; m++)
+			members[m] = offsets[j] + m;
 
-		for (auto point : cluster->points()) {
+		// Partial Fisher-Yates shuffle
+		for (uint32_t m = 0; m < count && count < size; m++)
+			swap(members[m], members[uniform_int_distribution<uint32_t>(m, size - 1)(generator)]);
 
-			double min = DBL_MAX;
-			Cluster* closest = nullptr;
+		members.resize(count);
+		sort(members.begin(), members.end(), [&](uint32_t i1, uint32_t i2) { return neighbor[i1] < neighbor[i2]; });
 
-			// Find closest cluster, other than the assigned one
-			for (auto cluster1 : clusters) {
-				if (cluster1 == cluster)
-					continue; 
+		chosen.insert(chosen.end(), members.begin(), members.end());
+		counts[j] = count;
+	}
+
+	vector<pair<uint32_t, uint32_t>> tiles;
+	for (uint32_t t = 0; t < chosen.size(); ) {
+		uint32_t end = t + 1;
+		while (end < chosen.size() && end - t < TILE && 
+			   owner[chosen[end]] == owner[chosen[t]] && neighbor[chosen[end]] == neighbor[chosen[t]])
+			end++;
+
+		tiles.push_back(pair(t, end));
+		t = end;
+	}
+
+	vector<double> scores(chosen.size(), 0);
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (uint32_t t = 0; t < tiles.size(); t++) {
+		uint32_t first = tiles[t].first, count = tiles[t].second - first;
+		uint32_t own = owner[chosen[first]], other = neighbor[chosen[first]];
+
+		// Singletons and clusterings without a neighbor score 0
+		if (other == K || clusters[own]->size() == 1)
+			continue;
+
+		double sums[2][TILE] = { };
+		uint32_t lists[2] = { own, other };
 
-				double distance = dist(point->data(), cluster->center());
+		for (uint32_t l = 0; l < 2; l++) {
+			for (uint32_t block = offsets[lists[l]]; block < offsets[lists[l] + 1]; block += BLOCK) {
+				uint32_t last = min(block + BLOCK, offsets[lists[l] + 1]);
 
-				if (distance < min) {
-					min = distance;
-					closest = cluster1;
+				for (uint32_t q = 0; q < count; q++) {
+					auto& point = *entries[chosen[first + q]];
+					for (uint32_t m = block; m < last; m++)
+						sums[l][q] += dist_(point, *entries[m]);
 				}
 			}
+		}
 
-			double a = average_distance(point, cluster, dist_);
-			double b = average_distance(point, closest, dist_);
+		for (uint32_t q = 0; q < count; q++) {
+			double a = sums[0][q] / (clusters[own]->size() - 1);
+			double b = sums[1][q] / clusters[other]->size();
 
-			sum += (b - a) / max(a, b);
+			scores[first + q] = max(a, b) > 0 ? (b - a) / max(a, b) : 0;
 		}
-		
-		stotal += sum;
+	}
+
+	for (auto entry : entries)
+		delete entry;
 
-		// Push Silhouette coefficient in vector
-		metr.push_back(sum / cluster->size());
+	delete [] storage;
+
+	// Stratified estimate, the finite population correction zeroes the margins of exhaustive strata
+	double variance = 0;
+	for (uint32_t j = 0, i = 0; j < K; j++) {
+		uint32_t count = counts[j], size = clusters[j]->size();
+		if (count == 0)
+			continue;
+
+		double sum = 0, squares = 0;
+		for (uint32_t m = 0; m < count; m++, i++) {
+			sum += scores[i];
+			squares += scores[i] * scores[i];
+		}
+
+		double mean = sum / count;
+		double spread = count > 1 ? max(0., (squares - count * mean * mean) / (count - 1)) : 0;
+		double error = spread / count * (1 - (double)count / size);
+		double weight = (double)size / n;
+
+		out.clusters[j] = mean;
+		out.margins[j] = 1.96 * sqrt(error);
+		out.total += weight * mean;
+		variance += weight * weight * error;
 	}
 
-	return pair(metr, stotal / dataset->size());
+	out.margin = 1.96 * sqrt(variance);
+
+	return out;
 }
 
 
@@ -247,8 +461,10 @@ double Clusterer::ObjectiveFunctionValue(Distance<uint8_t,double> dist){
 	
 	double error = 0;
 
-	for(auto cluster : clusters){
-		error += cluster->size() * cluster->ObjectiveFunctionValue(dist);
+	#pragma omp parallel for schedule(static) reduction(+:error)
+	for (uint32_t i = 0; i < assignment.size(); i++) {
+		if (assignment[i] != UNASSIGNED)
+			error += dist((*dataset)[i]->data(), clusters[assignment[i]]->center());
 	}
 
 	error /= dataset->size();
@@ -257,28 +473,62 @@ double Clusterer::ObjectiveFunctionValue(Distance<uint8_t,double> dist){
 }
 
 
+// Centers (as floats) and sizes of the clusters
+ClusterModel* Clusterer::model() const {
+	uint32_t dim = clusters[0]->center().len();
+	vector<float> centroids((size_t)clusters.size() * dim);
+	vector<uint32_t> sizes(clusters.size());
+
+	for (uint32_t j = 0; j < clusters.size(); j++) {
+		for (uint32_t d = 0; d < dim; d++)
+			centroids[(size_t)j * dim + d] = clusters[j]->center()[d];
+
+		sizes[j] = clusters[j]->size();
+	}
+
+	return new ClusterModel(centroids, dim, sizes);
+}
+
+
 void Clusterer::projectToDataset(DataSet& new_dataset){
 	
 	if(dataset->size() != new_dataset.size()){
 		throw runtime_error("Exception in projectToDataset: DataSet sizes must be equal!\n");
 	}
 
-	for(auto cluster : clusters){
-		cluster->projectToDataset(new_dataset);
-	}
+	// Same labels, so the assignment holds; sums and centers are recomputed in the new space
 	dataset = &new_dataset;
+	for (auto cluster : clusters)
+		cluster->clear(new_dataset.dim());
+
+	accumulate();
+	for (auto cluster : clusters)
+		cluster->update();
 }
 
 ////////////
 // Lloyd //
 ///////////
 
-Lloyd::Lloyd(DataSet& dataset, uint32_t k, Distance<uint8_t, double> dist) : Clusterer(dataset, k, dist) { }
+Lloyd::Lloyd(DataSet& dataset, uint32_t k, Distance<uint8_t, double> dist, Update update_, Seeding seeding) 
+: Clusterer(dataset, k, dist, seeding), update(update_), iterations_(0) { 
+	if (update == BATCH && dist != l2_distance<uint8_t, double>)
+		throw runtime_error("Exception in Lloyd: Batch updates only support the Euclidean distance!\n");
+}
 
 void Lloyd::apply() {
-	Cluster** indexes = new Cluster*[dataset->size()]();
-	
-	while (true) {
+	if (update == BATCH)
+		batch();
+	else
+		macqueen();
+}
+
+uint32_t Lloyd::iterations() const { return iterations_; }
+
+void Lloyd::macqueen() {
+	clear();
+
+	for (iterations_ = 1; ; iterations_++) {
 		uint32_t changes = 0;
 
 		// For every point
@@ -288,15 +538,18 @@ void Lloyd::apply() {
 			auto p = closest(point);
 
 			// Add point to the closest cluster, updating both centers (MacQueen)
-			if (p.second != indexes[index]) {
+			if (p.second != assignment[index]) {
 				changes++;
 				
-				if (indexes[index] != nullptr)
-					indexes[index]->remove(point);
+				if (assignment[index] != UNASSIGNED) {
+					clusters[assignment[index]]->remove(point);
+					clusters[assignment[index]]->update();
+				}
 					
-				p.second->add(point);
+				clusters[p.second]->add(point);
+				clusters[p.second]->update();
 
-				indexes[index] = p.second;
+				assignment[index] = p.second;
 			}
 		}
 
@@ -305,8 +558,322 @@ void Lloyd::apply() {
 			break;
 
 	}
+}
+
+// Squared distances of a byte vector or a float vector to a float center
+static inline float squared(const uint8_t* x, const float* c, uint32_t dim) {
+	uint32_t d = 0;
+	float sum = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+	__m256 acc = _mm256_setzero_ps();
+	for (; d + 8 <= dim; d += 8) {
+		__m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(x + d))));
+		__m256 diff = _mm256_sub_ps(v, _mm256_loadu_ps(c + d));
+		acc = _mm256_fmadd_ps(diff, diff, acc);
+	}
+
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	half = _mm_hadd_ps(half, half);
+	half = _mm_hadd_ps(half, half);
+	sum = _mm_cvtss_f32(half);
+#endif
+
+	for (; d < dim; d++) {
+		float diff = x[d] - c[d];
+		sum += diff * diff;
+	}
+
+	return sum;
+}
+
+static inline float squared(const float* x, const float* c, uint32_t dim) {
+	float sum = 0;
+	for (uint32_t d = 0; d < dim; d++) {
+		float diff = x[d] - c[d];
+		sum += diff * diff;
+	}
+
+	return sum;
+}
+
+// Closest and second closest center of a point, as (label, distance, second distance)
+static inline void nearest(const uint8_t* x, const vector<float>& centers, uint32_t dim, 
+						   uint32_t& best, float& first, float& second) {
+	first = second = FLT_MAX;
+	for (uint32_t j = 0, K = centers.size() / dim; j < K; j++) {
+		float distance = squared(x, centers.data() + (size_t)j * dim, dim);
+
+		if (distance < first) {
+			second = first;
+			first = distance;
+			best = j;
+		}
+		else if (distance < second)
+			second = distance;
+	}
+
+	first = sqrt(first);
+	second = sqrt(second);
+}
+
+#define BATCH_ITERS 300
+
+// Hamerly's algorithm: "upper" bounds the distance of a point to its center and "lower" the distance to
+// every other center. A point keeps its center without any distance computed as long as its upper bound
+// is below both its lower bound and half the distance of its center to the closest other one.
+void Lloyd::batch() {
+	uint32_t n = dataset->size(), dim = dataset->dim(), K = clusters.size();
+
+	vector<float> centers((size_t)K * dim);
+	for (uint32_t j = 0; j < K; j++) {
+		for (uint32_t d = 0; d < dim; d++)
+			centers[(size_t)j * dim + d] = clusters[j]->center()[d];
+	}
+
+	vector<uint32_t> assigned(n);
+	vector<float> upper(n), lower(n);
+	vector<double> means((size_t)K * dim);
+	vector<uint64_t> sizes(K);
+	vector<float> shift(K), half(K);
+
+	uint32_t changes = n;
+
+	#pragma omp parallel for schedule(static)
+	for (uint32_t i = 0; i < n; i++)
+		nearest((*dataset)[i]->data().get(), centers, dim, assigned[i], upper[i], lower[i]);
+
+	for (iterations_ = 1; ; iterations_++) {
+
+		// Centers from per-thread partial sums
+		fill(means.begin(), means.end(), 0);
+		fill(sizes.begin(), sizes.end(), 0);
+
+		#pragma omp parallel
+		{
+			vector<uint64_t> sums((size_t)K * dim, 0), counts(K, 0);
+
+			#pragma omp for schedule(static) nowait
+			for (uint32_t i = 0; i < n; i++) {
+				const uint8_t* x = (*dataset)[i]->data().get();
+				uint64_t* sum = sums.data() + (size_t)assigned[i] * dim;
+
+				for (uint32_t d = 0; d < dim; d++)
+					sum[d] += x[d];
+
+				counts[assigned[i]]++;
+			}
+
+			#pragma omp critical
+			{
+				for (size_t v = 0; v < sums.size(); v++)
+					means[v] += sums[v];
+
+				for (uint32_t j = 0; j < K; j++)
+					sizes[j] += counts[j];
+			}
+		}
+
+		// Empty clusters keep their center
+		float largest = 0, second = 0;
+		uint32_t farthest = 0;
+		for (uint32_t j = 0; j < K; j++) {
+			float* center = centers.data() + (size_t)j * dim;
+			vector<float> previous(center, center + dim);
+
+			if (sizes[j] > 0) {
+				for (uint32_t d = 0; d < dim; d++) {
+					means[(size_t)j * dim + d] /= sizes[j];
+					center[d] = means[(size_t)j * dim + d];
+				}
+			}
+			else {
+				for (uint32_t d = 0; d < dim; d++)
+					means[(size_t)j * dim + d] = center[d];
+			}
+
+			shift[j] = sqrt(squared(previous.data(), center, dim));
+			if (shift[j] > largest) {
+				second = largest;
+				largest = shift[j];
+				farthest = j;
+			}
+			else if (shift[j] > second)
+				second = shift[j];
+		}
+
+		if (changes == 0 || iterations_ >= BATCH_ITERS)
+			break;
+
+		// Half the distance of every center to its closest other center
+		fill(half.begin(), half.end(), FLT_MAX);
+		for (uint32_t j = 0; j < K; j++) {
+			for (uint32_t l = j + 1; l < K; l++) {
+				float distance = sqrt(squared(centers.data() + (size_t)j * dim, centers.data() + (size_t)l * dim, dim)) / 2;
+				half[j] = min(half[j], distance);
+				half[l] = min(half[l], distance);
+			}
+		}
+
+		changes = 0;
+
+		#pragma omp parallel for schedule(dynamic, 256) reduction(+:changes)
+		for (uint32_t i = 0; i < n; i++) {
+			uint32_t a = assigned[i];
+
+			// Moved centers loosen the bounds
+			upper[i] += shift[a];
+			lower[i] -= a == farthest ? second : largest;
+
+			float bound = max(half[a], lower[i]);
+			if (upper[i] <= bound)
+				continue;
+
+			const uint8_t* x = (*dataset)[i]->data().get();
+			upper[i] = sqrt(squared(x, centers.data() + (size_t)a * dim, dim));
+			if (upper[i] <= bound)
+				continue;
+
+			nearest(x, centers, dim, assigned[i], upper[i], lower[i]);
+			changes += assigned[i] != a;
+		}
+	}
+
+	// Memberships and exact (double) centers of the last assignment
+	assignment = assigned;
+	accumulate();
+
+	for (uint32_t j = 0; j < K; j++) {
+		for (uint32_t d = 0; d < dim; d++)
+			clusters[j]->center()[d] = means[(size_t)j * dim + d];
+	}
+}
+
+
+////////////////////////
+// Mini-batch K-Means //
+////////////////////////
+
+MiniBatchKMeans::MiniBatchKMeans(DataStream& stream_, uint32_t k, uint32_t batch_, uint32_t passes_, 
+								 uint32_t sample, Seeding seeding) 
+: stream(stream_), batch(max(batch_, 1u)), passes(passes_) {
+
+	uint32_t dim = stream.dim(), count;
+	sample = max(sample, k);
+
+	if (stream.size() == 0)
+		throw runtime_error("Exception in MiniBatchKMeans creation: Empty stream!\n");
+
+	// Reservoir sampling (Algorithm R): point i replaces a random slot with probability sample / (i + 1)
+	mt19937 generator(random_device{}());
+	vector<uint8_t> reservoir((size_t)min(sample, stream.size()) * dim);
+	vector<uint8_t> buffer((size_t)batch * dim);
+	uint64_t position = 0;
+
+	stream.rewind();
+	while ((count = stream.read(buffer.data(), batch)) > 0) {
+		for (uint32_t i = 0; i < count; i++, position++) {
+			uint64_t slot = position < sample ? position : uniform_int_distribution<uint64_t>(0, position)(generator);
+			if (slot < sample)
+				copy_n(buffer.data() + (size_t)i * dim, dim, reservoir.data() + slot * dim);
+		}
+	}
+
+	DataSet points(dim);
+	Vector<uint8_t> point(dim);
+	for (size_t offset = 0; offset < reservoir.size(); offset += dim) {
+		copy_n(reservoir.data() + offset, dim, point.get());
+		points.add(point);
+	}
+
+	vector<uint32_t> indexes;
+	vector<double> weights;
+
+	if (seeding == KMEANSPARALLEL)
+		indexes = oversample(points, k, l2_distance<uint8_t, double>, generator, weights);
+	else {
+		indexes.resize(points.size());
+		for (uint32_t i = 0; i < indexes.size(); i++)
+			indexes[i] = i;
+
+		weights.assign(indexes.size(), 1);
+	}
+
+	for (auto index : kmeanspp(points, indexes, weights, k, l2_distance<uint8_t, double>, generator)) {
+		auto& seed = points[index]->data();
+		for (uint32_t d = 0; d < dim; d++)
+			centers.push_back(seed[d]);
+	}
+
+	counts.assign(centers.size() / dim, 0);
+}
+
+uint64_t MiniBatchKMeans::seen() const {
+	uint64_t total = 0;
+	for (auto count : counts)
+		total += count;
+
+	return total;
+}
+
+ClusterModel* MiniBatchKMeans::model(const vector<uint32_t>& sizes) const {
+	return new ClusterModel(centers, stream.dim(), sizes);
+}
+
+// c = (v * c + sum of the new points) / (v + m), for the m points of the batch closest to c
+void MiniBatchKMeans::feed(const uint8_t* points, uint32_t count) {
+	uint32_t dim = stream.dim(), K = counts.size();
+	vector<uint32_t> assigned(count);
+
+	#pragma omp parallel for schedule(static)
+	for (uint32_t i = 0; i < count; i++) {
+		float first, second;
+		nearest(points + (size_t)i * dim, centers, dim, assigned[i], first, second);
+	}
+
+	// Points of the batch grouped by center (counting sort)
+	vector<uint32_t> offsets(K + 1, 0), order(count);
+	for (auto center : assigned)
+		offsets[center + 1]++;
+
+	for (uint32_t j = 0; j < K; j++)
+		offsets[j + 1] += offsets[j];
+
+	vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	for (uint32_t i = 0; i < count; i++)
+		order[next[assigned[i]]++] = i;
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (uint32_t j = 0; j < K; j++) {
+		uint32_t m = offsets[j + 1] - offsets[j];
+		if (m == 0)
+			continue;
+
+		vector<uint64_t> sum(dim, 0);
+		for (uint32_t p = offsets[j]; p < offsets[j + 1]; p++) {
+			const uint8_t* x = points + (size_t)order[p] * dim;
+			for (uint32_t d = 0; d < dim; d++)
+				sum[d] += x[d];
+		}
+
+		float* center = centers.data() + (size_t)j * dim;
+		double previous = counts[j];
+		counts[j] += m;
+
+		for (uint32_t d = 0; d < dim; d++)
+			center[d] = (previous * center[d] + sum[d]) / counts[j];
+	}
+}
 
-	delete [] indexes;
+void MiniBatchKMeans::apply() {
+	uint32_t count;
+	vector<uint8_t> buffer((size_t)batch * stream.dim());
+
+	for (uint32_t pass = 0; pass < passes; pass++) {
+		stream.rewind();
+		while ((count = stream.read(buffer.data(), batch)) > 0)
+			feed(buffer.data(), count);
+	}
 }
 
 
@@ -316,7 +883,8 @@ void Lloyd::apply() {
 
 RAssignment::RAssignment(DataSet& dataset, uint32_t k, Approximator* approx_, 
 						 Distance<uint8_t, double> dist1, 
-						 Distance<double, double>  dist2) : Clusterer(dataset, k, dist1), approx(approx_), dist(dist2) { }
+						 Distance<double, double>  dist2,
+						 Seeding seeding) : Clusterer(dataset, k, dist1, seeding), approx(approx_), dist(dist2) { }
 
 RAssignment::~RAssignment() {
 	delete approx;
@@ -337,51 +905,77 @@ double RAssignment::minDistBetweenClusters() {
 	return distance;
 }
 
+// Slot of a point: the bits of its (non-negative, float) distance to a cluster above the cluster.
+// Bits of non-negative floats order like the floats, so the smallest slot holds the closest cluster.
+#define EMPTY UINT64_MAX
+
+static inline void offer(atomic<uint64_t>& slot, float distance, uint32_t cluster) {
+	uint32_t bits;
+	memcpy(&bits, &distance, sizeof(bits));
+
+	uint64_t value = (uint64_t)bits << 32 | cluster;
+	uint64_t current = slot.load(memory_order_relaxed);
+
+	// Atomic min
+	while (value < current && !slot.compare_exchange_weak(current, value, memory_order_relaxed)) ;
+}
+
 #define MAX_ITERS 15
+
+// Every iteration, the range searches of all the clusters run in parallel, and each point found keeps
+// the closest of the clusters that found it in its slot. A point then moves if that cluster is closer
+// than the center of its own cluster, and the centers are recomputed in a parallel reduction.
 void RAssignment::apply() {
+	clear();
 
-	// Mapping from datapoints to clusters
-	Cluster** indexes = new Cluster*[dataset->size()]();
+	uint32_t n = dataset->size(), K = clusters.size();
+	vector<atomic<uint64_t>> slots(n);
 
 	double radius = minDistBetweenClusters() / 2;
 	uint8_t iters = 0;
 
 	while (iters++ < MAX_ITERS) {
 
-		uint32_t changes = 0;
-		
-		for (auto cluster : clusters) {
-			
+		#pragma omp parallel for schedule(static)
+		for (uint32_t i = 0; i < n; i++)
+			slots[i].store(EMPTY, memory_order_relaxed);
+
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (uint32_t cluster = 0; cluster < K; cluster++) {
+
 			// For each point within radius
-			for (auto p : approx->RangeSearch(cluster->center(), radius, Clusterer::dist)) {
-				
-				uint32_t index = p.first - 1;
-				double dist  = p.second;
+			for (auto p : approx->RangeSearch(clusters[cluster]->center(), radius, Clusterer::dist))
+				offer(slots[p.first - 1], p.second, cluster);
+		}
 
-				auto point = (*dataset)[index];
-				auto prev  = indexes[index];
-				
-				// If new cluster is closer than previous
-				if (prev == nullptr || (
-						cluster != prev && 
-						dist < Clusterer::dist(point->data(), prev->center())
-						)
-					) {
-
-					changes++;
-					
-					// Erase point from previous cluster
-					if (prev != nullptr)
-						prev->points().erase(point);
-						
-					// Add point to new one
-					cluster->points().insert(point);
-					indexes[index] = cluster;
-				}
+		uint32_t changes = 0;
+
+		#pragma omp parallel for schedule(dynamic, 1024) reduction(+:changes)
+		for (uint32_t index = 0; index < n; index++) {
+			uint64_t slot = slots[index].load(memory_order_relaxed);
+			if (slot == EMPTY)
+				continue;
+
+			uint32_t cluster = slot & UINT32_MAX, bits = slot >> 32;
+			uint32_t prev = assignment[index];
+
+			float dist;
+			memcpy(&dist, &bits, sizeof(dist));
+
+			// If new cluster is closer than previous
+			if (prev == UNASSIGNED || (
+					cluster != prev && 
+					dist < (float)Clusterer::dist((*dataset)[index]->data(), clusters[prev]->center())
+					)
+				) {
+
+				changes++;
+				assignment[index] = cluster;
 			}
 		}
 
 		// Update cluster centers
+		accumulate();
 		for (auto cluster : clusters)
 			cluster->update();
 
@@ -392,10 +986,63 @@ void RAssignment::apply() {
 	}
 
 	// Unnasigned points are assigned to closest cluster
-	for (auto point : *dataset) {
-		if (indexes[point->label() - 1] == nullptr) 
-			closest(point).second->add(point);
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (uint32_t index = 0; index < n; index++) {
+		if (assignment[index] == UNASSIGNED)
+			assignment[index] = closest((*dataset)[index]).second;
 	}
 
-	delete [] indexes;
-}
\ No newline at end of file
+	accumulate();
+	for (auto cluster : clusters)
+		cluster->update();
+}
+
+
+//////////////////////////
+// Product Quantization //
+//////////////////////////
+
+PQ* train_pq(DataSet& dataset, uint32_t m, uint32_t ksub, uint32_t sample) {
+
+	if (m == 0 || dataset.dim() % m != 0)
+		throw runtime_error("Exception in train_pq: Dimension must be a multiple of the number of sub-vectors!\n");
+
+	uint32_t dsub = dataset.dim() / m;
+
+	// Random sample, without replacement
+	vector<uint32_t> indexes(dataset.size());
+	for (uint32_t i = 0; i < indexes.size(); i++)
+		indexes[i] = i;
+
+	shuffle(indexes.begin(), indexes.end(), mt19937(random_device{}()));
+	indexes.resize(min(sample, dataset.size()));
+
+	ksub = min(ksub, (uint32_t)indexes.size());
+	vector<float> codebooks((size_t)m * ksub * dsub);
+
+	for (uint32_t j = 0; j < m; j++) {
+
+		// Sub-vectors of the sample in the j-th sub-space
+		DataSet subspace(dsub);
+		Vector<uint8_t> sub(dsub);
+		for (auto index : indexes) {
+			for (uint32_t d = 0; d < dsub; d++)
+				sub[d] = (*dataset[index]).data()[j * dsub + d];
+
+			subspace.add(sub);
+		}
+
+		Lloyd lloyd(subspace, ksub, l2_distance<uint8_t, double>, BATCH);
+		lloyd.apply();
+
+		// Seeding may pick fewer than ksub centers, the missing ones repeat the first
+		auto& clusters = lloyd.get();
+		for (uint32_t c = 0; c < ksub; c++) {
+			auto& center = clusters[c < clusters.size() ? c : 0]->center();
+			for (uint32_t d = 0; d < dsub; d++)
+				codebooks[((size_t)j * ksub + c) * dsub + d] = center[d];
+		}
+	}
+
+	return new PQ(dataset, m, ksub, codebooks);
+}
@@ -4,12 +4,24 @@
 
 #include "utils.hpp"
 #include "Vector.hpp"
+#include "PQ.hpp"
+#include "Sketch.hpp"
+#include "Pivots.hpp"
 
 
 class Approximator {
     protected:
 		DataSet& dataset;
 
+		// Optional prefilter: only the "survivors" candidates closest in Hamming distance are ranked exactly
+		const Sketch* sketch;
+		uint32_t survivors;
+
+		// Optional pivot table, used by the exact searches to skip distances
+		const Pivots* pivots;
+
+		std::vector<PAIR> filtered(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const;
+
     public:
         Approximator(DataSet& dataset);
         virtual ~Approximator();
@@ -26,4 +38,18 @@ class Approximator {
         virtual std::vector<PAIR> 
         RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const;
 
+        // Labels of the points the approximator would consider for the query (all of them by default)
+        virtual std::vector<uint32_t> candidates(DataPoint& query) const;
+
+        // Sketches of the dataset used by kANN( ), none to rank every candidate exactly
+        void prefilter(const Sketch* sketch, uint32_t survivors);
+
+        // Pivot table of the dataset used by kNN( ) and the exhaustive RangeSearch( ), none to compute every distance
+        void prune(const Pivots* pivots);
+
+        // Scans the PQ codes of the candidates, re-ranking the closest "shortlist" exactly
+        std::vector<PAIR>
+        CodeSearch(DataPoint& query, uint32_t k, const PQ& codes, uint32_t shortlist, 
+                   Distance<uint8_t, uint8_t> dist) const;
+
 };
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Distance a model was trained with, only the Euclidean one so far
+typedef enum { EUCLIDEAN = 0 } Metric;
+
+// Centroids of a clustering, with a batched nearest-centroid scan. Models are saved to binary files:
+// "KMDL", then version, metric, number of centroids and dimension (uint32 each), the size of every
+// cluster (uint32) and the centroids (float), all in native byte order.
+class ClusterModel {
+    private:
+        uint32_t k;
+        uint32_t vector_size;
+        Metric metric_;
+        std::vector<float> centroids;   // k x dim
+        std::vector<float> norms;       // Squared norms of the centroids
+        std::vector<uint32_t> sizes;
+
+        void prepare();
+
+    public:
+        ClusterModel(const std::vector<float>& centroids, uint32_t dim,
+                     const std::vector<uint32_t>& sizes={}, Metric metric=EUCLIDEAN);
+        ClusterModel(std::string path);
+
+        void save(std::string path) const;
+
+        uint32_t size() const;
+        uint32_t dim() const;
+        Metric metric() const;
+        const float* centroid(uint32_t j) const;
+        uint32_t members(uint32_t j) const;
+
+        // Closest centroid of "count" vectors stored one after the other, and optionally its distance
+        void assign(const uint8_t* vectors, uint32_t count, uint32_t* out, float* distances=nullptr) const;
+        void assign(const float* vectors, uint32_t count, uint32_t* out, float* distances=nullptr) const;
+
+        // Squared distances of a vector to every centroid, up to its own squared norm
+        void scores(const float* vector, float* out) const;
+};
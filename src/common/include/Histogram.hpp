@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <ostream>
+
+// Log-linear histogram of latencies in nanoseconds, in the style of HdrHistogram: values below 2^PRECISION
+// are counted exactly and every larger power of two is split in 2^PRECISION equal buckets, so a percentile
+// is off by less than 1% of itself. Recording is a bit scan and an increment. A histogram is not thread
+// safe: in parallel runs every thread records into its own and they are merged at the end.
+class Histogram {
+    private:
+        std::vector<uint64_t> counts;
+        uint64_t total;
+        uint64_t sum;
+        uint64_t largest;
+
+    public:
+        Histogram();
+
+        void record(uint64_t nanoseconds);
+        void merge(const Histogram& other);
+        void reset();
+
+        uint64_t count() const;
+        uint64_t max() const;
+        double mean() const;
+
+        // Smallest recorded value (up to the bucket width) that "percent" % of the values do not exceed
+        uint64_t percentile(double percent) const;
+
+        // "p50 / p90 / p99 / p99.9 / max" in milliseconds
+        void report(std::ostream& out) const;
+};
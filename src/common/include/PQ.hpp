@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include "utils.hpp"
+#include "Vector.hpp"
+
+// Product quantizer: each vector is split into m sub-vectors of dim / m dimensions and every
+// sub-vector is stored as the index (1 byte) of its closest centroid in a codebook of ksub <= 256
+// centroids. Query distances are estimated with asymmetric lookup tables (ADC).
+class PQ {
+    private:
+        uint32_t m;
+        uint32_t ksub;
+        uint32_t dsub;
+        std::vector<float> codebooks;   // m x ksub x dsub
+        std::vector<uint8_t> codes;     // One row of m bytes per point, in label order
+
+    public:
+        PQ(DataSet& dataset, uint32_t m, uint32_t ksub, const std::vector<float>& codebooks);
+
+        uint32_t size() const;
+        uint32_t bytes() const;
+
+        void encode(Vector<uint8_t>& vector, uint8_t* out) const;
+        void add(Vector<uint8_t>& vector);
+        void replace(uint32_t label, Vector<uint8_t>& vector);
+        void permute(const std::vector<uint32_t>& order);
+
+        // Squared distances of the query sub-vectors to every centroid, m x ksub
+        std::vector<float> table(Vector<uint8_t>& query) const;
+
+        // Estimated squared distances of the query to points, from its table
+        float distance(const std::vector<float>& table, uint32_t label) const;
+        void scan(const std::vector<float>& table, const uint32_t* labels, uint32_t count, float* out) const;
+
+        std::vector<PAIR> rerank(DataSet& dataset, Vector<uint8_t>& query, const std::vector<uint32_t>& candidates,
+                                 uint32_t N, uint32_t shortlist, Distance<uint8_t, uint8_t> dist) const;
+};
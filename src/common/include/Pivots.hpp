@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "utils.hpp"
+#include "Vector.hpp"
+
+// LAESA pivot table: the distances of every point to "count" pivots, chosen far apart from each other,
+// are precomputed. By the triangle inequality, max_p |d(q, p) - d(x, p)| is a lower bound of d(q, x),
+// so a point whose bound exceeds the current search radius is skipped without computing d(q, x).
+// The bounds only hold for the metric the table was built with: searches check theirs with matches( ).
+// The metric is given both between points and between a point and a real vector (such as a center).
+class Pivots {
+    private:
+        DataSet& dataset;
+        Distance<uint8_t, uint8_t> metric;
+        Distance<uint8_t, double> real;
+        uint32_t count;
+        std::vector<uint32_t> pivots;   // Labels of the pivots
+        std::vector<float> table;       // One row of "count" distances per point, in label order
+        float largest;                  // Largest distance in the table
+
+        // Distances computed and skipped by the searches
+        mutable std::atomic<uint64_t> computed;
+        mutable std::atomic<uint64_t> skipped;
+
+    public:
+        Pivots(DataSet& dataset, uint32_t count=16, Distance<uint8_t, uint8_t> metric=l2_distance<uint8_t, uint8_t>,
+               Distance<uint8_t, double> real=l2_distance<uint8_t, double>);
+
+        uint32_t size() const;
+        uint32_t length() const;
+
+        void add(Vector<uint8_t>& vector);
+        void permute(const std::vector<uint32_t>& order);
+
+        // Whether a search distance is the metric of the table, so that its bounds apply
+        bool matches(Distance<uint8_t, uint8_t> dist) const;
+        bool matches(Distance<uint8_t, double> dist) const;
+
+        // Distances of a query to the pivots
+        std::vector<float> distances(Vector<uint8_t>& query) const;
+        std::vector<float> distances(Vector<double>& query) const;
+
+        // Lower bound of the distance of the query to a point, 0 for points past the end of the table
+        float bound(const float* query, uint32_t label) const;
+
+        // Margin for the float rounding of the bounds of a query
+        float tolerance(const std::vector<float>& query) const;
+
+        void record(uint64_t computed, uint64_t skipped) const;
+        double rate() const;    // Fraction of the distances skipped
+        void reset();
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Per-dimension scalar quantizer: every dimension is mapped linearly from its trained [min, max]
+// range to 2^bits levels. 8-bit codes take one byte per dimension, 4-bit codes two dimensions per byte.
+class ScalarQuantizer {
+    private:
+        uint32_t dim;
+        uint32_t bits;
+        std::vector<float> lower;
+        std::vector<float> step;
+
+        uint32_t level(uint32_t d, float value) const;
+    public:
+        ScalarQuantizer(const float* data, uint32_t count, uint32_t dim, uint32_t bits=8);
+
+        uint32_t dimension() const;
+        uint32_t bytes() const;
+
+        void encode(const float* vector, uint8_t* out) const;
+        void decode(const uint8_t* code, float* out) const;
+
+        // Squared distances of the query to every value of every code byte, bytes() x 256
+        std::vector<float> table(const float* query) const;
+        float distance(const std::vector<float>& table, const uint8_t* code) const;
+};
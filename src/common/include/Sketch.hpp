@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "utils.hpp"
+#include "Vector.hpp"
+
+// Binary sketches: bit i of a code is set when the point's projection on the i-th random Gaussian
+// direction (as in LSH) is above the dataset's median, so the Hamming distance between two codes
+// grows with the angle between the centered points. Codes of bits / 64 words are stored densely.
+class Sketch {
+    private:
+        uint32_t dim;
+        uint32_t bits;
+        uint32_t words;
+        std::vector<float> projections;  // dim x bits
+        std::vector<float> thresholds;
+        std::vector<uint64_t> codes;     // One row of "words" words per point, in label order
+
+        void project(Vector<uint8_t>& vector, float* out) const;
+    public:
+        Sketch(DataSet& dataset, uint32_t bits=128);
+
+        uint32_t size() const;
+        uint32_t length() const;
+
+        std::vector<uint64_t> encode(Vector<uint8_t>& vector) const;
+        void add(Vector<uint8_t>& vector);
+        void replace(uint32_t label, Vector<uint8_t>& vector);
+        void permute(const std::vector<uint32_t>& order);
+
+        uint32_t distance(const uint64_t* query, uint32_t label) const;
+        void scan(const uint64_t* query, const uint32_t* labels, uint32_t count, uint32_t* out) const;
+
+        // The "keep" candidates with the smallest Hamming distance to the query
+        std::vector<uint32_t> filter(const uint64_t* query, const std::vector<uint32_t>& candidates, uint32_t keep) const;
+};
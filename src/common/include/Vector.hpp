@@ -12,6 +12,7 @@ class Vector{
 	private:
 		uint32_t size;
 		T* data;
+		bool owner;
 		
 	public:
 		Vector(uint32_t size, T value=0);
@@ -47,6 +48,7 @@ class Vector{
 		Vector& operator/=(const T& scalar);
 
 		T* get();
+		void relocate(T* memory);
 };
 
 #include "../modules/Vector.tcc"
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <vector>
 #include <chrono>
 #include "Vector.hpp"
+#include "SQ.hpp"
 
 #define PAIR std::pair<uint32_t, double>
 
@@ -13,41 +14,116 @@ template<typename T1, typename T2>
 double l2_distance(Vector<T1>& v1, Vector<T2>& v2);
 #include "../modules/Distances.tcc"
 
+// Monotonic timer, read in seconds or as integer nanoseconds (no float conversion, for per-query latencies)
 class Stopwatch {
     private:
-        std::chrono::time_point<std::chrono::high_resolution_clock> time;
+        std::chrono::time_point<std::chrono::steady_clock> time;
     public:
         Stopwatch();
         void start();
         double stop();
+        uint64_t elapsed() const;
+};
+
+// Events of PerfGroup::hardware( ), in that order
+typedef enum { CYCLES, INSTRUCTIONS, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES, EVENTS } Event;
+
+// Hardware/software counters (Linux perf_event_open), enabled, disabled and read together as one perf event
+// group, so they cover exactly the same instructions. Events the kernel does not expose are left out and read
+// as 0. The counters follow the thread that opened the group, and only that thread: the work of other threads,
+// including those it starts later, is not counted. A group of one event serves as a single counter.
+class PerfGroup {
+    private:
+        int leader;
+        std::vector<int> fds;   // One per event, -1 if it could not be opened
+    public:
+        PerfGroup(const std::vector<std::pair<uint32_t, uint64_t>>& events);
+        ~PerfGroup();
+
+        // Cycles, instructions, last level cache and data TLB read misses, branch misses
+        static std::vector<std::pair<uint32_t, uint64_t>> hardware();
+
+        bool available() const;
+        bool available(uint32_t event) const;
+        void start();
+        std::vector<uint64_t> stop();   // One count per event, scaled up if the kernel multiplexed the group
 };
 
 class DataPoint {
     private:
-        const uint32_t id;
+        uint32_t id;
         Vector<uint8_t>* vector;
     
     public:
         DataPoint(std::ifstream& input_, uint32_t size, uint32_t id_);
+        DataPoint(const Vector<uint8_t>& vector_, uint32_t id_);
         ~DataPoint();
         uint32_t label() const;
         Vector<uint8_t>& data() const;
+        void relocate(uint8_t* memory, uint32_t id);
 };
 
+// Element types of IDX files (third byte of the magic number), any other type is read as bytes.
+// IDX has no half precision type, FLOAT16 uses a free code.
+typedef enum { BYTES = 0x08, FLOAT16 = 0x0A, FLOAT32 = 0x0D } Element;
+
 class DataSet {
     private:
         std::vector<DataPoint*> points;
         uint32_t vector_size;
 
+        // Contiguous storage and label remapping, set up by permute()
+        uint8_t* storage;
+        std::vector<uint32_t> originals;
+        std::vector<uint32_t> labels;
+
+        // Float files keep their full precision vectors, while the points hold 8-bit scalar quantized codes
+        std::vector<float> reals;
+        const ScalarQuantizer* sq;
+        ScalarQuantizer* trained;
+
     public:
-        DataSet(std::string path, uint32_t files=0);
+        DataSet(std::string path, uint32_t files=0, const ScalarQuantizer* quantizer=nullptr);
+        DataSet(uint32_t dim);
         ~DataSet();
         
         uint32_t dim() const;
         uint32_t size() const;
 		DataPoint* operator[](uint32_t index) const;
+        DataPoint* add(const Vector<uint8_t>& vector);
+        void replace(uint32_t label, const Vector<uint8_t>& vector);
+
+        void permute(const std::vector<uint32_t>& order);
+        uint32_t original(uint32_t label) const;
+        uint32_t label(uint32_t original) const;    // 0 if the original label is unknown or was retired
+        uint32_t renumber(uint32_t label);
+
+        bool floating() const;
+        const ScalarQuantizer* quantizer() const;
+        const float* real(uint32_t label) const;
+        double distance(const float* query, uint32_t label) const;
 
         std::vector<DataPoint*>::iterator begin();
         std::vector<DataPoint*>::iterator end();
 
-};
\ No newline at end of file
+};
+
+// Sequential reader of the points of an IDX byte file, a batch at a time, for data that need not fit in memory
+class DataStream {
+    private:
+        std::ifstream input;
+        std::string path;
+        uint32_t count;
+        uint32_t vector_size;
+        uint32_t position;      // Points read so far
+
+    public:
+        DataStream(std::string path);
+
+        uint32_t dim() const;
+        uint32_t size() const;
+
+        // Reads up to "points" vectors, one after the other, into "buffer". Returns the number read, 0 at the end.
+        uint32_t read(uint8_t* buffer, uint32_t points);
+        void rewind();
+};
@@ -1,4 +1,5 @@
 #include <queue>
+#include <algorithm>
 #include <unordered_set>
 
 #include "Approximator.hpp"
@@ -6,12 +7,70 @@
 using namespace std;
 
 
-Approximator::Approximator(DataSet& dataset_) : dataset(dataset_) { }; 
+Approximator::Approximator(DataSet& dataset_) : dataset(dataset_), sketch(nullptr), survivors(0), pivots(nullptr) { }; 
 Approximator::~Approximator() { }; 
 
+// Exact k nearest neighbours with a pivot table: the k points with the smallest lower bounds
+// give an initial radius, then only the points whose bound is below the radius are measured.
+// The distance must be the metric of the table (see kNN( ))
+static vector<PAIR> 
+pivoted(DataSet& dataset, const Pivots& pivots, DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) {
+
+	auto qd = pivots.distances(query.data());
+	float tolerance = pivots.tolerance(qd);
+
+	vector<pair<float, uint32_t>> bounds(dataset.size());
+	for (uint32_t i = 0; i < dataset.size(); i++)
+		bounds[i] = pair(pivots.bound(qd.data(), i + 1), i + 1);
+
+	k = min((size_t)k, bounds.size());
+	nth_element(bounds.begin(), bounds.begin() + k, bounds.end());
+
+	auto comparator = [](const PAIR t1, const PAIR t2) {
+		return t1.second < t2.second;
+	};
+
+	// Max heap of the k closest points so far
+	priority_queue<PAIR, vector<PAIR>, decltype(comparator)> pq(comparator);
+	uint64_t computed = pivots.length(), skipped = 0;
+
+	for (uint32_t i = 0; i < bounds.size(); i++) {
+		uint32_t label = bounds[i].second;
+
+		if (i >= k && bounds[i].first - tolerance >= pq.top().second) {
+			skipped++;
+			continue;
+		}
+
+		double distance = dist(query.data(), dataset[label - 1]->data());
+		computed++;
+
+		if (pq.size() < k)
+			pq.push(pair(label, distance));
+		else if (distance < pq.top().second) {
+			pq.pop();
+			pq.push(pair(label, distance));
+		}
+	}
+
+	pivots.record(computed, skipped);
+
+	vector< PAIR > out(pq.size());
+	for (uint32_t i = out.size(); i > 0; i--) {
+		out[i - 1] = pq.top();
+		pq.pop();
+	}
+
+	return out;
+}
+
 vector<PAIR> 
 Approximator::kNN(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const {
 
+	// The bounds of the table do not hold for other distances, every point is measured then
+	if (pivots != nullptr && k > 0 && pivots->matches(dist))
+		return pivoted(dataset, *pivots, query, k, dist);
+
 	auto comparator = [](const PAIR t1, const PAIR t2) {
 		return t1.second > t2.second;
 	};
@@ -33,17 +92,102 @@ Approximator::kNN(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist)
 	return out;	
 }
 
+vector<uint32_t> Approximator::candidates(DataPoint&) const {
+	vector<uint32_t> out;
+	for (auto point : dataset)
+		out.push_back(point->label());
+
+	return out;
+}
+
+void Approximator::prune(const Pivots* pivots_) {
+	pivots = pivots_;
+}
+
+void Approximator::prefilter(const Sketch* sketch_, uint32_t survivors_) {
+	sketch = sketch_;
+	survivors = survivors_;
+}
+
+vector<PAIR> 
+Approximator::filtered(DataPoint& query, uint32_t k, Distance<uint8_t, uint8_t> dist) const {
+	auto code = sketch->encode(query.data());
+
+	vector<PAIR> out;
+	for (auto label : sketch->filter(code.data(), candidates(query), max(survivors, k)))
+		out.push_back(pair(label, dist(query.data(), dataset[label - 1]->data())));
+
+	auto closer = [](PAIR t1, PAIR t2) { return t1.second < t2.second; };
+
+	k = min((size_t)k, out.size());
+	partial_sort(out.begin(), out.begin() + k, out.end(), closer);
+	out.resize(k);
+
+	return out;
+}
+
+vector<PAIR> 
+Approximator::CodeSearch(DataPoint& query, uint32_t k, const PQ& codes, uint32_t shortlist, 
+						 Distance<uint8_t, uint8_t> dist) const {
+	return codes.rerank(dataset, query.data(), candidates(query), k, shortlist, dist);
+}
+
 std::vector<PAIR>
 Approximator::kANN(DataPoint& p, uint32_t k, Distance<uint8_t, uint8_t> dist) const {
-	return kNN(p, k, dist);
+	return sketch != nullptr ? filtered(p, k, dist) : kNN(p, k, dist);
 }
 
+// Exhaustive range searches, points whose lower bound is already out of range are skipped when the
+// distance is the metric of the pivot table
 std::vector<PAIR> 
 Approximator::RangeSearch(DataPoint& query, double range, Distance<uint8_t, uint8_t> dist) const {
-	throw runtime_error("Call of RangeSearch() from Approximator class object!");
+	const Pivots* table = pivots != nullptr && pivots->matches(dist) ? pivots : nullptr;
+
+	vector<float> qd = table ? table->distances(query.data()) : vector<float>();
+	float tolerance = table ? table->tolerance(qd) : 0;
+	uint64_t skipped = 0;
+
+	vector<PAIR> out;
+	for (auto point : dataset) {
+		if (table && table->bound(qd.data(), point->label()) - tolerance >= range) {
+			skipped++;
+			continue;
+		}
+
+		double distance = dist(query.data(), point->data());
+		if (distance < range)
+			out.push_back(pair(point->label(), distance));
+	}
+
+	if (table)
+		table->record(qd.size() + dataset.size() - skipped, skipped);
+
+	return out;
 }
 
+// Reverse Assignment
 std::vector<PAIR> 
 Approximator::RangeSearch(Vector<double>& query, double range, Distance<uint8_t, double> dist) const {
-	throw runtime_error("Call of RangeSearch() from Approximator class object!");
+	const Pivots* table = pivots != nullptr && pivots->matches(dist) ? pivots : nullptr;
+
+	vector<float> qd = table ? table->distances(query) : vector<float>();
+	float tolerance = table ? table->tolerance(qd) : 0;
+	uint64_t skipped = 0;
+
+	vector<PAIR> out;
+	for (auto point : dataset) {
+		if (table && table->bound(qd.data(), point->label()) - tolerance >= range) {
+			skipped++;
+			continue;
+		}
+
+		double distance = dist(point->data(), query);
+		if (distance < range)
+			out.push_back(pair(point->label(), distance));
+	}
+
+	if (table)
+		table->record(qd.size() + dataset.size() - skipped, skipped);
+
+	return out;
 }
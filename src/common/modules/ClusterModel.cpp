@@ -0,0 +1,205 @@
+#include "ClusterModel.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+#define VERSION 1
+
+// Vectors scanned together, every centroid is loaded once per batch
+#define BATCH 64
+
+// Byte vectors converted to floats at a time
+#define CHUNK 4096
+
+ClusterModel::ClusterModel(const vector<float>& centroids_, uint32_t dim, const vector<uint32_t>& sizes_, Metric metric)
+: k(dim == 0 ? 0 : centroids_.size() / dim), vector_size(dim), metric_(metric), centroids(centroids_), sizes(sizes_) {
+
+    if (k == 0 || centroids.size() != (size_t)k * dim)
+        throw runtime_error("Exception in ClusterModel creation: Centroids must be k vectors of the given dimension!\n");
+
+    sizes.resize(k, 0);
+    prepare();
+}
+
+ClusterModel::ClusterModel(string path) {
+    ifstream input(path.data(), ios::binary);
+
+    if (input.fail())
+        throw runtime_error("Exception in ClusterModel creation: " + path + " could not be opened!\n");
+
+    char magic[4];
+    uint32_t version, metric;
+    input.read(magic, 4);
+    input.read((char*)&version, 4);
+    input.read((char*)&metric, 4);
+    input.read((char*)&k, 4);
+    input.read((char*)&vector_size, 4);
+
+    if (input.fail() || memcmp(magic, "KMDL", 4) != 0 || version != VERSION)
+        throw runtime_error("Exception in ClusterModel creation: " + path + " is not a cluster model!\n");
+
+    if (metric != EUCLIDEAN)
+        throw runtime_error("Exception in ClusterModel creation: Unknown metric!\n");
+
+    metric_ = (Metric)metric;
+    sizes.resize(k);
+    centroids.resize((size_t)k * vector_size);
+    input.read((char*)sizes.data(), (size_t)k * sizeof(uint32_t));
+    input.read((char*)centroids.data(), centroids.size() * sizeof(float));
+
+    if (input.fail())
+        throw runtime_error("Exception in ClusterModel creation: " + path + " is truncated!\n");
+
+    prepare();
+}
+
+void ClusterModel::prepare() {
+    norms.resize(k);
+    for (uint32_t j = 0; j < k; j++) {
+        const float* c = centroid(j);
+
+        norms[j] = 0;
+        for (uint32_t d = 0; d < vector_size; d++)
+            norms[j] += c[d] * c[d];
+    }
+}
+
+void ClusterModel::save(string path) const {
+    ofstream output(path.data(), ios::binary);
+
+    if (output.fail())
+        throw runtime_error("Exception in ClusterModel save: " + path + " could not be opened!\n");
+
+    uint32_t header[4] = { VERSION, (uint32_t)metric_, k, vector_size };
+    output.write("KMDL", 4);
+    output.write((const char*)header, sizeof(header));
+    output.write((const char*)sizes.data(), (size_t)k * sizeof(uint32_t));
+    output.write((const char*)centroids.data(), centroids.size() * sizeof(float));
+}
+
+uint32_t ClusterModel::size() const { return k; }
+uint32_t ClusterModel::dim() const { return vector_size; }
+Metric ClusterModel::metric() const { return metric_; }
+const float* ClusterModel::centroid(uint32_t j) const { return centroids.data() + (size_t)j * vector_size; }
+uint32_t ClusterModel::members(uint32_t j) const { return sizes[j]; }
+
+// Dot products of 4 vectors, "stride" floats apart, with a centroid that is loaded once for the four
+static inline void dot4(const float* x, size_t stride, const float* c, uint32_t n, float* out) {
+    uint32_t d = 0;
+    float sums[4] = { 0, 0, 0, 0 };
+
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+    for (; d + 8 <= n; d += 8) {
+        __m256 centroid = _mm256_loadu_ps(c + d);
+        for (uint32_t v = 0; v < 4; v++)
+            acc[v] = _mm256_fmadd_ps(_mm256_loadu_ps(x + v * stride + d), centroid, acc[v]);
+    }
+
+    for (uint32_t v = 0; v < 4; v++) {
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc[v]), _mm256_extractf128_ps(acc[v], 1));
+        half = _mm_hadd_ps(half, half);
+        half = _mm_hadd_ps(half, half);
+        sums[v] = _mm_cvtss_f32(half);
+    }
+#endif
+
+    for (; d < n; d++) {
+        for (uint32_t v = 0; v < 4; v++)
+            sums[v] += x[v * stride + d] * c[d];
+    }
+
+    copy_n(sums, 4, out);
+}
+
+// argmin |x - c|^2 = argmin |c|^2 - 2 x.c, over a batch padded to a multiple of 4 vectors
+void ClusterModel::assign(const float* vectors, uint32_t count, uint32_t* out, float* distances) const {
+    uint32_t dim = vector_size;
+
+    #pragma omp parallel
+    {
+        vector<float> batch((size_t)(BATCH + 3) * dim, 0);
+        vector<float> best(BATCH);
+        float dots[4];
+
+        #pragma omp for schedule(dynamic, 1)
+        for (uint32_t start = 0; start < count; start += BATCH) {
+            uint32_t size = min((uint32_t)BATCH, count - start);
+            copy_n(vectors + (size_t)start * dim, (size_t)size * dim, batch.begin());
+            fill(best.begin(), best.end(), FLT_MAX);
+
+            for (uint32_t j = 0; j < k; j++) {
+                for (uint32_t i = 0; i < size; i += 4) {
+                    dot4(batch.data() + (size_t)i * dim, dim, centroid(j), dim, dots);
+
+                    for (uint32_t v = 0; v < 4 && i + v < size; v++) {
+                        float score = norms[j] - 2 * dots[v];
+                        if (score < best[v + i]) {
+                            best[v + i] = score;
+                            out[start + i + v] = j;
+                        }
+                    }
+                }
+            }
+
+            if (distances == nullptr)
+                continue;
+
+            for (uint32_t i = 0; i < size; i++) {
+                const float* x = batch.data() + (size_t)i * dim;
+                float norm = 0;
+                for (uint32_t d = 0; d < dim; d++)
+                    norm += x[d] * x[d];
+
+                distances[start + i] = sqrt(max(norm + best[i], 0.f));
+            }
+        }
+    }
+}
+
+// Byte vectors are converted one batch at a time
+void ClusterModel::assign(const uint8_t* vectors, uint32_t count, uint32_t* out, float* distances) const {
+    vector<float> converted((size_t)min(count, (uint32_t)CHUNK) * vector_size);
+
+    for (uint32_t start = 0; start < count; start += CHUNK) {
+        uint32_t size = min((uint32_t)CHUNK, count - start);
+        const uint8_t* from = vectors + (size_t)start * vector_size;
+
+        #pragma omp parallel for schedule(static)
+        for (size_t v = 0; v < (size_t)size * vector_size; v++)
+            converted[v] = from[v];
+
+        assign(converted.data(), size, out + start, distances == nullptr ? nullptr : distances + start);
+    }
+}
+
+// Four centroids at a time, against the same vector
+void ClusterModel::scores(const float* vector, float* out) const {
+    uint32_t j = 0;
+    float dots[4];
+
+    for (; j + 4 <= k; j += 4) {
+        dot4(centroid(j), vector_size, vector, vector_size, dots);
+        for (uint32_t v = 0; v < 4; v++)
+            out[j + v] = norms[j + v] - 2 * dots[v];
+    }
+
+    for (; j < k; j++) {
+        const float* c = centroid(j);
+
+        float sum = 0;
+        for (uint32_t d = 0; d < vector_size; d++)
+            sum += vector[d] * c[d];
+
+        out[j] = norms[j] - 2 * sum;
+    }
+}
@@ -1,3 +1,9 @@
+#include <cmath>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 template<typename T1, typename T2>
 double l2_distance(Vector<T1>& v1, Vector<T2>& v2) {
     if (v1.len() != v2.len()) 
@@ -14,3 +20,72 @@ double l2_distance(Vector<T1>& v1, Vector<T2>& v2) {
 	return sqrt(sum);
 }
 
+// Byte vectors: the squared differences are summed exactly, 16 dimensions at a time with AVX2, in 32-bit
+// lanes that hold at most dims / 16 * 2 * 255² each (exact up to ~500k dimensions) and are added up in 64 bits,
+// so the result is the same as the generic version
+template<>
+inline double l2_distance(Vector<uint8_t>& v1, Vector<uint8_t>& v2) {
+    if (v1.len() != v2.len()) 
+        throw std::runtime_error("Exception in L2 Metric: Dimensions of vectors must match!\n");
+
+    const uint8_t* a = v1.get();
+    const uint8_t* b = v2.get();
+    uint32_t i = 0, size = v1.len();
+    uint64_t sum = 0;
+
+#ifdef __AVX2__
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 16 <= size; i += 16) {
+        __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        __m256i diff = _mm256_sub_epi16(x, y);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(diff, diff));
+    }
+
+    // The sum of all the lanes no longer fits in 32 bits past ~66k dimensions
+    __m256i wide = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(acc)),
+                                    _mm256_cvtepu32_epi64(_mm256_extracti128_si256(acc, 1)));
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(wide), _mm256_extracti128_si256(wide, 1));
+    sum = (uint64_t)_mm_cvtsi128_si64(half) + (uint64_t)_mm_extract_epi64(half, 1);
+#endif
+
+    for (; i < size; i++) {
+        int diff = (int)a[i] - (int)b[i];
+        sum += diff * diff;
+    }
+
+    return sqrt((double)sum);
+}
+
+// Byte vectors against real ones (such as cluster centers), 4 dimensions at a time with AVX2
+template<>
+inline double l2_distance(Vector<uint8_t>& v1, Vector<double>& v2) {
+    if (v1.len() != v2.len()) 
+        throw std::runtime_error("Exception in L2 Metric: Dimensions of vectors must match!\n");
+
+    const uint8_t* a = v1.get();
+    const double* b = v2.get();
+    uint32_t i = 0, size = v1.len();
+    double sum = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256d acc = _mm256_setzero_pd();
+    for (; i + 4 <= size; i += 4) {
+        int32_t bytes;
+        std::memcpy(&bytes, a + i, 4);
+        __m256d x = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+        __m256d diff = _mm256_sub_pd(x, _mm256_loadu_pd(b + i));
+        acc = _mm256_fmadd_pd(diff, diff, acc);
+    }
+
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+#endif
+
+    for (; i < size; i++) {
+        double diff = (double)a[i] - b[i];
+        sum += diff * diff;
+    }
+
+    return sqrt(sum);
+}
@@ -0,0 +1,81 @@
+#include "Histogram.hpp"
+
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+using namespace std;
+
+// 2^7 buckets per power of two, a relative error below 1/128
+#define PRECISION 7
+#define SUB (1u << PRECISION)
+
+// Values below SUB have a bucket each, then SUB buckets for every power of two up to 2^63
+#define BUCKETS ((64 - PRECISION + 1) * SUB)
+
+static inline uint32_t bucket(uint64_t value) {
+    if (value < SUB)
+        return value;
+
+    uint32_t shift = 63 - __builtin_clzll(value) - PRECISION;
+    return (shift + 1) * SUB + (uint32_t)(value >> shift) - SUB;
+}
+
+// Largest value of a bucket
+static inline uint64_t highest(uint32_t index) {
+    if (index < SUB)
+        return index;
+
+    uint32_t shift = index / SUB - 1;
+    uint64_t sub = SUB + index % SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+Histogram::Histogram() : counts(BUCKETS, 0), total(0), sum(0), largest(0) { }
+
+void Histogram::record(uint64_t nanoseconds) {
+    counts[bucket(nanoseconds)]++;
+    total++;
+    sum += nanoseconds;
+    largest = std::max(largest, nanoseconds);
+}
+
+void Histogram::merge(const Histogram& other) {
+    for (uint32_t i = 0; i < BUCKETS; i++)
+        counts[i] += other.counts[i];
+
+    total += other.total;
+    sum += other.sum;
+    largest = std::max(largest, other.largest);
+}
+
+void Histogram::reset() {
+    fill(counts.begin(), counts.end(), 0);
+    total = sum = largest = 0;
+}
+
+uint64_t Histogram::count() const { return total; }
+uint64_t Histogram::max() const { return largest; }
+double Histogram::mean() const { return total == 0 ? 0 : (double)sum / total; }
+
+uint64_t Histogram::percentile(double percent) const {
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = std::max((uint64_t)ceil(percent / 100 * total), (uint64_t)1), seen = 0;
+    for (uint32_t i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank)
+            return std::min(highest(i), largest);
+    }
+
+    return largest;
+}
+
+void Histogram::report(ostream& out) const {
+    out << "p50 / p90 / p99 / p99.9 / max: " << fixed << setprecision(4);
+    for (double percent : { 50., 90., 99., 99.9 })
+        out << percentile(percent) / 1e6 << " / ";
+
+    out << largest / 1e6 << " ms";
+}
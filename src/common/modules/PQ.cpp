@@ -0,0 +1,155 @@
+#include "PQ.hpp"
+
+#include <cfloat>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+PQ::PQ(DataSet& dataset, uint32_t m_, uint32_t ksub_, const vector<float>& codebooks_)
+: m(m_), ksub(ksub_), dsub(dataset.dim() / m_), codebooks(codebooks_) {
+
+    if (m == 0 || dataset.dim() % m != 0)
+        throw runtime_error("Exception in PQ creation: Dimension must be a multiple of the number of sub-vectors!\n");
+
+    if (ksub == 0 || ksub > 256 || codebooks.size() != (size_t)m * ksub * dsub)
+        throw runtime_error("Exception in PQ creation: Codebooks must hold m x ksub (<= 256) centroids!\n");
+
+    codes.resize((size_t)dataset.size() * m);
+    for (auto point : dataset)
+        encode(point->data(), codes.data() + (size_t)(point->label() - 1) * m);
+}
+
+uint32_t PQ::size() const { return codes.size() / m; }
+uint32_t PQ::bytes() const { return m; }
+
+void PQ::encode(Vector<uint8_t>& vector, uint8_t* out) const {
+    for (uint32_t j = 0; j < m; j++) {
+        const float* centroid = codebooks.data() + (size_t)j * ksub * dsub;
+        const uint8_t* sub = vector.get() + j * dsub;
+
+        float min_dist = FLT_MAX;
+        for (uint32_t c = 0; c < ksub; c++, centroid += dsub) {
+            float sum = 0;
+            for (uint32_t d = 0; d < dsub; d++) {
+                float diff = sub[d] - centroid[d];
+                sum += diff * diff;
+            }
+
+            if (sum < min_dist) {
+                min_dist = sum;
+                out[j] = c;
+            }
+        }
+    }
+}
+
+// Code of a point appended to the DataSet, it gets the next label
+void PQ::add(Vector<uint8_t>& vector) {
+    codes.resize(codes.size() + m);
+    encode(vector, codes.data() + codes.size() - m);
+}
+
+void PQ::replace(uint32_t label, Vector<uint8_t>& vector) {
+    encode(vector, codes.data() + (size_t)(label - 1) * m);
+}
+
+// Follows DataSet::permute, code order[i] moves to position i
+void PQ::permute(const vector<uint32_t>& order) {
+    vector<uint8_t> permuted(codes.size());
+
+    for (uint32_t i = 0; i < order.size(); i++)
+        copy_n(codes.begin() + (size_t)order[i] * m, m, permuted.begin() + (size_t)i * m);
+
+    codes = permuted;
+}
+
+vector<float> PQ::table(Vector<uint8_t>& query) const {
+    vector<float> out((size_t)m * ksub);
+
+    const float* centroid = codebooks.data();
+    for (uint32_t j = 0; j < m; j++) {
+        const uint8_t* sub = query.get() + j * dsub;
+
+        for (uint32_t c = 0; c < ksub; c++, centroid += dsub) {
+            float sum = 0;
+            for (uint32_t d = 0; d < dsub; d++) {
+                float diff = sub[d] - centroid[d];
+                sum += diff * diff;
+            }
+
+            out[j * ksub + c] = sum;
+        }
+    }
+
+    return out;
+}
+
+float PQ::distance(const vector<float>& table, uint32_t label) const {
+    const uint8_t* code = codes.data() + (size_t)(label - 1) * m;
+    const float* t = table.data();
+
+    float sum = 0;
+    for (uint32_t j = 0; j < m; j++, t += ksub)
+        sum += t[code[j]];
+
+    return sum;
+}
+
+// Batched lookups: with AVX2, the table entries of 8 points are gathered at once for every sub-vector
+void PQ::scan(const vector<float>& table, const uint32_t* labels, uint32_t count, float* out) const {
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    for (; i + 8 <= count; i += 8) {
+        const uint8_t* c[8];
+        for (uint32_t k = 0; k < 8; k++)
+            c[k] = codes.data() + (size_t)(labels[i + k] - 1) * m;
+
+        __m256 sum = _mm256_setzero_ps();
+        const float* t = table.data();
+
+        for (uint32_t j = 0; j < m; j++, t += ksub) {
+            __m256i index = _mm256_setr_epi32(c[0][j], c[1][j], c[2][j], c[3][j],
+                                              c[4][j], c[5][j], c[6][j], c[7][j]);
+            sum = _mm256_add_ps(sum, _mm256_i32gather_ps(t, index, 4));
+        }
+
+        _mm256_storeu_ps(out + i, sum);
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = distance(table, labels[i]);
+}
+
+// Scans the codes of the candidates and re-ranks the closest "shortlist" of them with the exact distance
+vector<PAIR> PQ::rerank(DataSet& dataset, Vector<uint8_t>& query, const vector<uint32_t>& candidates,
+                        uint32_t N, uint32_t shortlist, Distance<uint8_t, uint8_t> dist) const {
+
+    auto lookup = table(query);
+
+    vector<float> estimates(candidates.size());
+    scan(lookup, candidates.data(), candidates.size(), estimates.data());
+
+    vector<PAIR> out;
+    for (uint32_t i = 0; i < candidates.size(); i++)
+        out.push_back(pair(candidates[i], estimates[i]));
+
+    auto closer = [](PAIR t1, PAIR t2) { return t1.second < t2.second; };
+
+    uint32_t size = min((size_t)max(shortlist, N), out.size());
+    partial_sort(out.begin(), out.begin() + size, out.end(), closer);
+    out.resize(size);
+
+    for (auto& p : out)
+        p.second = dist(query, dataset[p.first - 1]->data());
+
+    sort(out.begin(), out.end(), closer);
+    if (out.size() > N)
+        out.resize(N);
+
+    return out;
+}
@@ -0,0 +1,139 @@
+#include "Pivots.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <stdexcept>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+Pivots::Pivots(DataSet& dataset_, uint32_t count_, Distance<uint8_t, uint8_t> metric_, Distance<uint8_t, double> real_)
+: dataset(dataset_), metric(metric_), real(real_), count(min(count_, dataset_.size())), largest(0), computed(0), skipped(0) {
+
+    if (count == 0)
+        throw runtime_error("Exception in Pivots creation: At least one pivot is needed!\n");
+
+    table.resize((size_t)dataset.size() * count);
+
+    // Greedy max-min selection: each pivot is the point farthest from the ones chosen so far,
+    // starting from a random one. The distances to the last pivot fill a column of the table.
+    vector<double> nearest(dataset.size(), DBL_MAX);
+    uint32_t next = Vector<uint32_t>(1, UNIFORM, 0, dataset.size() - 1)[0];
+
+    for (uint32_t j = 0; j < count; j++) {
+        pivots.push_back(next + 1);
+        auto& pivot = dataset[next]->data();
+
+        double farthest = -1;
+        for (uint32_t i = 0; i < dataset.size(); i++) {
+            double distance = metric(pivot, dataset[i]->data());
+
+            table[(size_t)i * count + j] = distance;
+            largest = max(largest, (float)distance);
+            nearest[i] = min(nearest[i], distance);
+
+            if (nearest[i] > farthest) {
+                farthest = nearest[i];
+                next = i;
+            }
+        }
+    }
+}
+
+uint32_t Pivots::size() const { return table.size() / count; }
+uint32_t Pivots::length() const { return count; }
+
+// Row of a point appended to the DataSet, it gets the next label
+void Pivots::add(Vector<uint8_t>& vector) {
+    auto row = distances(vector);
+    for (auto distance : row)
+        largest = max(largest, distance);
+
+    table.insert(table.end(), row.begin(), row.end());
+}
+
+// Follows DataSet::permute, row order[i] moves to position i
+void Pivots::permute(const vector<uint32_t>& order) {
+    vector<float> permuted(table.size());
+
+    for (uint32_t i = 0; i < order.size(); i++)
+        copy_n(table.begin() + (size_t)order[i] * count, count, permuted.begin() + (size_t)i * count);
+
+    table = permuted;
+
+    // The pivots themselves move as well
+    vector<uint32_t> position(order.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+        position[order[i]] = i + 1;
+
+    for (auto& pivot : pivots)
+        pivot = position[pivot - 1];
+}
+
+bool Pivots::matches(Distance<uint8_t, uint8_t> dist) const { return dist == metric; }
+bool Pivots::matches(Distance<uint8_t, double> dist) const { return dist == real; }
+
+vector<float> Pivots::distances(Vector<uint8_t>& query) const {
+    vector<float> out(count);
+    for (uint32_t j = 0; j < count; j++)
+        out[j] = metric(query, dataset[pivots[j] - 1]->data());
+
+    return out;
+}
+
+vector<float> Pivots::distances(Vector<double>& query) const {
+    vector<float> out(count);
+    for (uint32_t j = 0; j < count; j++)
+        out[j] = real(dataset[pivots[j] - 1]->data(), query);
+
+    return out;
+}
+
+float Pivots::bound(const float* query, uint32_t label) const {
+    if (label > size())
+        return 0;
+
+    const float* row = table.data() + (size_t)(label - 1) * count;
+    uint32_t j = 0;
+    float out = 0;
+
+#ifdef __AVX2__
+    // |a - b| by clearing the sign bit
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 acc = _mm256_setzero_ps();
+    for (; j + 8 <= count; j += 8)
+        acc = _mm256_max_ps(acc, _mm256_and_ps(mask, _mm256_sub_ps(_mm256_loadu_ps(query + j), _mm256_loadu_ps(row + j))));
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    out = *max_element(lanes, lanes + 8);
+#endif
+
+    for (; j < count; j++)
+        out = max(out, abs(query[j] - row[j]));
+
+    return out;
+}
+
+// A float difference is off by at most a few ulps of the larger operand
+float Pivots::tolerance(const vector<float>& query) const {
+    return 1e-6f * (*max_element(query.begin(), query.end()) + largest);
+}
+
+void Pivots::record(uint64_t computed_, uint64_t skipped_) const {
+    computed += computed_;
+    skipped += skipped_;
+}
+
+double Pivots::rate() const {
+    uint64_t total = computed + skipped;
+    return total == 0 ? 0 : (double)skipped / total;
+}
+
+void Pivots::reset() {
+    computed = 0;
+    skipped = 0;
+}
@@ -0,0 +1,96 @@
+#include "SQ.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+ScalarQuantizer::ScalarQuantizer(const float* data, uint32_t count, uint32_t dim_, uint32_t bits_)
+: dim(dim_), bits(bits_), lower(dim_, FLT_MAX), step(dim_, -FLT_MAX) {
+
+    if (bits != 8 && bits != 4)
+        throw runtime_error("Exception in ScalarQuantizer creation: Only 8 and 4 bit codes are supported!\n");
+
+    // Bounds of every dimension, step holds the upper bound until the end
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t d = 0; d < dim; d++) {
+            lower[d] = min(lower[d], data[(size_t)i * dim + d]);
+            step[d]  = max(step[d], data[(size_t)i * dim + d]);
+        }
+    }
+
+    uint32_t levels = (1 << bits) - 1;
+    for (uint32_t d = 0; d < dim; d++) {
+        if (count == 0)
+            lower[d] = step[d] = 0;
+
+        step[d] = max((step[d] - lower[d]) / levels, 1e-9f);
+    }
+}
+
+uint32_t ScalarQuantizer::dimension() const { return dim; }
+uint32_t ScalarQuantizer::bytes() const { return bits == 8 ? dim : (dim + 1) / 2; }
+
+// Values out of the trained range are clamped
+uint32_t ScalarQuantizer::level(uint32_t d, float value) const {
+    float l = roundf((value - lower[d]) / step[d]);
+    return min(max(l, 0.f), (float)((1 << bits) - 1));
+}
+
+void ScalarQuantizer::encode(const float* vector, uint8_t* out) const {
+    if (bits == 8) {
+        for (uint32_t d = 0; d < dim; d++)
+            out[d] = level(d, vector[d]);
+
+        return ;
+    }
+
+    fill(out, out + bytes(), 0);
+    for (uint32_t d = 0; d < dim; d++)
+        out[d / 2] |= level(d, vector[d]) << (4 * (d & 1));
+}
+
+void ScalarQuantizer::decode(const uint8_t* code, float* out) const {
+    for (uint32_t d = 0; d < dim; d++) {
+        uint32_t l = bits == 8 ? code[d] : (code[d / 2] >> (4 * (d & 1))) & 15;
+        out[d] = lower[d] + l * step[d];
+    }
+}
+
+vector<float> ScalarQuantizer::table(const float* query) const {
+    vector<float> out((size_t)bytes() * 256, 0);
+
+    for (uint32_t b = 0; b < bytes(); b++) {
+        for (uint32_t c = 0; c < 256; c++) {
+            float sum = 0;
+
+            if (bits == 8) {
+                float diff = query[b] - (lower[b] + c * step[b]);
+                sum = diff * diff;
+            }
+            else {
+                for (uint32_t h = 0; h < 2 && 2 * b + h < dim; h++) {
+                    uint32_t d = 2 * b + h;
+                    float diff = query[d] - (lower[d] + ((c >> (4 * h)) & 15) * step[d]);
+                    sum += diff * diff;
+                }
+            }
+
+            out[b * 256 + c] = sum;
+        }
+    }
+
+    return out;
+}
+
+float ScalarQuantizer::distance(const vector<float>& table, const uint8_t* code) const {
+    const float* t = table.data();
+
+    float sum = 0;
+    for (uint32_t b = 0, size = bytes(); b < size; b++, t += 256)
+        sum += t[code[b]];
+
+    return sum;
+}
@@ -0,0 +1,163 @@
+#include "Sketch.hpp"
+
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+#define SAMPLE 10000
+
+Sketch::Sketch(DataSet& dataset, uint32_t bits_)
+: dim(dataset.dim()), bits(bits_), words(bits_ / 64), thresholds(bits_) {
+
+    if (bits == 0 || bits % 64 != 0 || bits > 1024)
+        throw runtime_error("Exception in Sketch creation: Bits must be a multiple of 64, up to 1024!\n");
+
+    Vector<float> random(dim * bits, NORMAL, 0, 1);
+    projections.assign(random.get(), random.get() + (size_t)dim * bits);
+
+    // Median of every projection over a sample, so that every bit splits the dataset in half
+    vector<uint32_t> sample(dataset.size());
+    for (uint32_t i = 0; i < sample.size(); i++)
+        sample[i] = i;
+
+    shuffle(sample.begin(), sample.end(), mt19937(random_device{}()));
+    sample.resize(min((size_t)SAMPLE, sample.size()));
+
+    vector<float> projected((size_t)sample.size() * bits);
+    for (uint32_t i = 0; i < sample.size(); i++)
+        project(dataset[sample[i]]->data(), projected.data() + (size_t)i * bits);
+
+    vector<float> column(sample.size());
+    for (uint32_t b = 0; b < bits && !sample.empty(); b++) {
+        for (uint32_t i = 0; i < sample.size(); i++)
+            column[i] = projected[(size_t)i * bits + b];
+
+        nth_element(column.begin(), column.begin() + column.size() / 2, column.end());
+        thresholds[b] = column[column.size() / 2];
+    }
+
+    codes.reserve((size_t)dataset.size() * words);
+    for (auto point : dataset)
+        add(point->data());
+}
+
+uint32_t Sketch::size() const { return codes.size() / words; }
+uint32_t Sketch::length() const { return bits; }
+
+// Projections are accumulated one dimension at a time, zero dimensions are skipped
+void Sketch::project(Vector<uint8_t>& vector, float* out) const {
+    fill(out, out + bits, 0);
+
+    const float* row = projections.data();
+    for (uint32_t d = 0; d < dim; d++, row += bits) {
+        float value = vector[d];
+        if (value == 0)
+            continue;
+
+        for (uint32_t b = 0; b < bits; b++)
+            out[b] += value * row[b];
+    }
+}
+
+vector<uint64_t> Sketch::encode(Vector<uint8_t>& vector) const {
+    float projected[1024];
+    project(vector, projected);
+
+    std::vector<uint64_t> out(words, 0);
+    for (uint32_t b = 0; b < bits; b++) {
+        if (projected[b] > thresholds[b])
+            out[b / 64] |= (uint64_t)1 << (b % 64);
+    }
+
+    return out;
+}
+
+// Code of a point appended to the DataSet, it gets the next label
+void Sketch::add(Vector<uint8_t>& vector) {
+    auto code = encode(vector);
+    codes.insert(codes.end(), code.begin(), code.end());
+}
+
+void Sketch::replace(uint32_t label, Vector<uint8_t>& vector) {
+    auto code = encode(vector);
+    copy(code.begin(), code.end(), codes.begin() + (size_t)(label - 1) * words);
+}
+
+// Follows DataSet::permute, code order[i] moves to position i
+void Sketch::permute(const vector<uint32_t>& order) {
+    vector<uint64_t> permuted(codes.size());
+
+    for (uint32_t i = 0; i < order.size(); i++)
+        copy_n(codes.begin() + (size_t)order[i] * words, words, permuted.begin() + (size_t)i * words);
+
+    codes = permuted;
+}
+
+uint32_t Sketch::distance(const uint64_t* query, uint32_t label) const {
+    const uint64_t* code = codes.data() + (size_t)(label - 1) * words;
+    uint32_t w = 0, sum = 0;
+
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; w + 4 <= words; w += 4) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(query + w)),
+                                     _mm256_loadu_si256((const __m256i*)(code + w)));
+        acc = _mm256_add_epi64(acc, _mm256_popcnt_epi64(x));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+#elif defined(__AVX2__)
+    // Popcount of every nibble by table lookup, summed per 64-bit lane
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+
+    __m256i acc = _mm256_setzero_si256();
+    for (; w + 4 <= words; w += 4) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(query + w)),
+                                     _mm256_loadu_si256((const __m256i*)(code + w)));
+        __m256i count = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(x, low)),
+                                        _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(count, _mm256_setzero_si256()));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_cvtsi128_si64(half) + _mm_extract_epi64(half, 1);
+#endif
+
+    for (; w < words; w++)
+        sum += __builtin_popcountll(query[w] ^ code[w]);
+
+    return sum;
+}
+
+void Sketch::scan(const uint64_t* query, const uint32_t* labels, uint32_t count, uint32_t* out) const {
+    for (uint32_t i = 0; i < count; i++)
+        out[i] = distance(query, labels[i]);
+}
+
+vector<uint32_t> Sketch::filter(const uint64_t* query, const vector<uint32_t>& candidates, uint32_t keep) const {
+    if (candidates.size() <= keep)
+        return candidates;
+
+    vector<uint32_t> hamming(candidates.size());
+    scan(query, candidates.data(), candidates.size(), hamming.data());
+
+    vector<pair<uint32_t, uint32_t>> ranked(candidates.size());
+    for (uint32_t i = 0; i < candidates.size(); i++)
+        ranked[i] = pair(hamming[i], candidates[i]);
+
+    nth_element(ranked.begin(), ranked.begin() + keep, ranked.end());
+
+    vector<uint32_t> out(keep);
+    for (uint32_t i = 0; i < keep; i++)
+        out[i] = ranked[i].second;
+
+    return out;
+}
@@ -1,5 +1,6 @@
 #include <random>
 #include <iomanip>
+#include <algorithm>
 #include "Vector.hpp"
 
 //////////////////
@@ -8,14 +9,14 @@
 
 template <typename T>
 Vector<T>::Vector(uint32_t size_, T value)
-: size(size_), data(new T[size_]) {
+: size(size_), data(new T[size_]), owner(true) {
 	for(uint32_t i = 0; i < size; i++)
 		data[i] = value;
 }
 
 template <typename T>
 Vector<T>::Vector(uint32_t size_, Distribution distr, T a, T b)
-: size(size_), data(new T[size_]) {
+: size(size_), data(new T[size_]), owner(true) {
 
 	switch (distr) {
 	case NORMAL:
@@ -31,7 +32,7 @@ Vector<T>::Vector(uint32_t size_, Distribution distr, T a, T b)
 
 template <typename T>
 Vector<T>::Vector(const Vector<T>& v)
-: size(v.len()), data(new T[v.len()]) {
+: size(v.len()), data(new T[v.len()]), owner(true) {
 	for(uint32_t i = 0; i < v.len(); i++)
 		data[i] = v[i];
 }
@@ -40,14 +41,14 @@ Vector<T>::Vector(const Vector<T>& v)
 template <typename T>
 template <typename U>
 Vector<T>::Vector(const Vector<U>& v)
-: size(v.len()), data(new T[v.len()]) {
+: size(v.len()), data(new T[v.len()]), owner(true) {
 	for(uint32_t i = 0; i < v.len(); i++)
 		data[i] = v[i];
 }
 
 template<typename T>
 Vector<T>::Vector(std::ifstream& input, uint32_t size_)
-: size(size_), data(new uint8_t[size_]) {
+: size(size_), data(new uint8_t[size_]), owner(true) {
 	for(uint32_t i = 0; i < size; i++)
 		data[i] = input.get();
 }
@@ -58,7 +59,10 @@ Vector<T>::Vector(std::ifstream& input, uint32_t size_)
 ////////////////
 
 template <typename T>
-Vector<T>::~Vector() { delete[] data; }
+Vector<T>::~Vector() { 
+	if (owner)
+		delete[] data; 
+}
 
 
 ///////////////
@@ -214,3 +218,15 @@ Vector<T>& Vector<T>::operator/=(const T& scalar) {
 
 template <typename T>
 T* Vector<T>::get() { return data; } 
+
+// Moves the elements to externally owned memory (e.g. a contiguous DataSet buffer)
+template <typename T>
+void Vector<T>::relocate(T* memory) {
+	std::copy(data, data + size, memory);
+
+	if (owner)
+		delete[] data;
+
+	data  = memory;
+	owner = false;
+}
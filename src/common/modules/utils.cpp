@@ -1,5 +1,12 @@
 #include "utils.hpp"
 #include <endian.h>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 using namespace std;
 
@@ -9,11 +16,94 @@ using namespace std;
 ///////////////
 
 
-Stopwatch::Stopwatch() : time(chrono::high_resolution_clock::now()) { }
-void Stopwatch::start() { time = chrono::high_resolution_clock::now(); }
+Stopwatch::Stopwatch() : time(chrono::steady_clock::now()) { }
+void Stopwatch::start() { time = chrono::steady_clock::now(); }
 double Stopwatch::stop() { 
-    auto end_time = chrono::high_resolution_clock::now(); 
-    return chrono::duration_cast<chrono::duration<float>>(end_time - time).count();
+    auto end_time = chrono::steady_clock::now(); 
+    return chrono::duration<double>(end_time - time).count();
+}
+
+uint64_t Stopwatch::elapsed() const {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - time).count();
+}
+
+
+///////////////
+// PerfGroup //
+///////////////
+
+PerfGroup::PerfGroup(const vector<pair<uint32_t, uint64_t>>& events) : leader(-1), fds(events.size(), -1) {
+    for (uint32_t i = 0; i < events.size(); i++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+
+        attr.size           = sizeof(attr);
+        attr.type           = events[i].first;
+        attr.config         = events[i].second;
+        attr.disabled       = leader < 0;   // The members follow the leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+        if (leader < 0)
+            leader = fds[i];
+    }
+}
+
+PerfGroup::~PerfGroup() {
+    for (auto fd : fds) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+vector<pair<uint32_t, uint64_t>> PerfGroup::hardware() {
+    auto cache = [](uint64_t cache) {
+        return pair((uint32_t)PERF_TYPE_HW_CACHE,
+                    cache | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    };
+
+    return { pair((uint32_t)PERF_TYPE_HARDWARE, (uint64_t)PERF_COUNT_HW_CPU_CYCLES),
+             pair((uint32_t)PERF_TYPE_HARDWARE, (uint64_t)PERF_COUNT_HW_INSTRUCTIONS),
+             cache(PERF_COUNT_HW_CACHE_LL),
+             cache(PERF_COUNT_HW_CACHE_DTLB),
+             pair((uint32_t)PERF_TYPE_HARDWARE, (uint64_t)PERF_COUNT_HW_BRANCH_MISSES) };
+}
+
+bool PerfGroup::available() const { return leader >= 0; }
+bool PerfGroup::available(uint32_t event) const { return fds[event] >= 0; }
+
+void PerfGroup::start() {
+    if (leader < 0)
+        return ;
+
+    // The members stay enabled, they only count while the leader is
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+vector<uint64_t> PerfGroup::stop() {
+    vector<uint64_t> out(fds.size(), 0);
+
+    if (leader < 0)
+        return out;
+
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, 0);
+
+    // Number of events, time enabled and running, then the counts in the order the events joined the group
+    vector<uint64_t> values(3 + fds.size());
+    ssize_t size = read(leader, values.data(), values.size() * sizeof(uint64_t));
+    if (size < (ssize_t)(3 * sizeof(uint64_t)))
+        return out;
+
+    double scale = values[2] > 0 && values[2] < values[1] ? (double)values[1] / values[2] : 1;
+    for (uint32_t i = 0, member = 0; i < fds.size() && member < values[0]; i++) {
+        if (fds[i] >= 0)
+            out[i] = values[3 + member++] * scale;
+    }
+
+    return out;
 }
 
 ////////////////
@@ -21,26 +111,64 @@ double Stopwatch::stop() {
 ////////////////
 
 DataPoint::DataPoint(ifstream& input_, uint32_t size, uint32_t id_) : id(id_), vector(new Vector<uint8_t>(input_, size)) { }
+DataPoint::DataPoint(const Vector<uint8_t>& vector_, uint32_t id_) : id(id_), vector(new Vector<uint8_t>(vector_)) { }
 DataPoint::~DataPoint() { delete vector; }
 
 uint32_t DataPoint::label() const { return id; }
 Vector<uint8_t>& DataPoint::data() const { return *vector; }
 
+void DataPoint::relocate(uint8_t* memory, uint32_t id_) {
+    vector->relocate(memory);
+    id = id_;
+}
+
 
 
 //////////////
 // Data Set //
 //////////////
 
-DataSet::DataSet(string path, uint32_t files) {
+// IEEE half precision to single precision
+static float half_to_float(uint16_t h) {
+    uint32_t sign     = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else {
+        // Subnormal, normalize the mantissa
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float out;
+    memcpy(&out, &bits, sizeof(out));
+    return out;
+}
+
+// Float files are quantized with the given quantizer (e.g. the one of the training set, for queries),
+// or with one trained on the file itself
+DataSet::DataSet(string path, uint32_t files, const ScalarQuantizer* quantizer) 
+: storage(nullptr), sq(nullptr), trained(nullptr) {
     
     ifstream input(path.data(), ios::binary);
 
     if (input.fail())
         throw runtime_error("Exception during DataSet creation: " + path + " could not be opened!\n");
 
+    uint8_t magic[4];
     uint32_t count, h, w;
-    input.read((char*)&count, 4); // Discard magic number
+    input.read((char*)magic, 4);
     input.read((char*)&count, 4);
     input.read((char*)&h, 4);
     input.read((char*)&w, 4);
@@ -50,16 +178,56 @@ DataSet::DataSet(string path, uint32_t files) {
     w     = be32toh(w);
     vector_size = h * w;
 
+    if (magic[2] != FLOAT32 && magic[2] != FLOAT16) {
+        for (uint32_t i = 0; i < count; i++) 
+            points.push_back(new DataPoint(input, vector_size, i + 1));
+        
+        input.close();
+        return ;
+    }
+
+    // Big endian elements, as every multi-byte IDX type
+    reals.resize((size_t)count * vector_size);
+    for (auto& value : reals) {
+        if (magic[2] == FLOAT32) {
+            uint32_t bits;
+            input.read((char*)&bits, 4);
+            bits = be32toh(bits);
+            memcpy(&value, &bits, sizeof(value));
+        }
+        else {
+            uint16_t bits;
+            input.read((char*)&bits, 2);
+            value = half_to_float(be16toh(bits));
+        }
+    }
 
-    for (uint32_t i = 0; i < count; i++) 
-        points.push_back(new DataPoint(input, vector_size, i + 1));
-    
     input.close();
+
+    if (quantizer == nullptr)
+        quantizer = trained = new ScalarQuantizer(reals.data(), count, vector_size, 8);
+
+    if (quantizer->dimension() != vector_size || quantizer->bytes() != vector_size)
+        throw runtime_error("Exception during DataSet creation: Quantizer must have 8-bit codes of the same dimension!\n");
+
+    sq = quantizer;
+
+    Vector<uint8_t> code(vector_size);
+    for (uint32_t i = 0; i < count; i++) {
+        sq->encode(reals.data() + (size_t)i * vector_size, code.get());
+        points.push_back(new DataPoint(code, i + 1));
+    }
 }
 
+// Empty in-memory DataSet, filled with add()
+DataSet::DataSet(uint32_t dim) : vector_size(dim), storage(nullptr), sq(nullptr), trained(nullptr) { }
+
 DataSet::~DataSet() {
     for (auto point : points)
         delete point;
+
+    delete[] storage;
+    delete trained;
 }
 
 uint32_t DataSet::dim() const{ return vector_size; }
@@ -67,5 +235,162 @@ uint32_t DataSet::size() const{ return points.size(); }
 
 DataPoint* DataSet::operator[](uint32_t i) const { return points[i]; }
 
+DataPoint* DataSet::add(const Vector<uint8_t>& vector) {
+    if (vector.len() != vector_size)
+        throw runtime_error("Exception during DataSet insertion: Dimensions of vectors must match!\n");
+
+    points.push_back(new DataPoint(vector, points.size() + 1));
+
+    // Only the code is known, its reconstruction stands in for the full precision vector
+    if (floating()) {
+        reals.resize(reals.size() + vector_size);
+        sq->decode(&vector[0], reals.data() + reals.size() - vector_size);
+    }
+
+    // New points get the next original label, which maps to themselves unless points were permuted or renumbered
+    if (!originals.empty()) {
+        labels.push_back(points.size());
+        originals.push_back(labels.size());
+    }
+
+    return points.back();
+}
+
+// Overwrites the vector of a point in place, its label and original label are kept (see renumber( ))
+void DataSet::replace(uint32_t label, const Vector<uint8_t>& vector) {
+    if (vector.len() != vector_size)
+        throw runtime_error("Exception during DataSet replacement: Dimensions of vectors must match!\n");
+
+    copy_n(&vector[0], vector_size, &points[label - 1]->data()[0]);
+
+    if (floating())
+        sq->decode(&vector[0], reals.data() + (size_t)(label - 1) * vector_size);
+}
+
+// Places point order[i] at position i: labels become i + 1 and the vectors are copied, 
+// in the new order, to one contiguous buffer. DataPoint objects are kept, so pointers stay valid.
+void DataSet::permute(const vector<uint32_t>& order) {
+    if (order.size() != points.size())
+        throw runtime_error("Exception in DataSet permutation: Order must contain every point!\n");
+
+    uint32_t issued = labels.empty() ? points.size() : labels.size();
+
+    uint8_t* memory = new uint8_t[(size_t)points.size() * vector_size];
+    vector<DataPoint*> permuted(points.size());
+    vector<uint32_t> permuted_originals(points.size());
+
+    for (uint32_t i = 0; i < points.size(); i++) {
+        permuted[i] = points[order[i]];
+        permuted_originals[i] = original(order[i] + 1);
+        permuted[i]->relocate(memory + (size_t)i * vector_size, i + 1);
+    }
+
+    if (floating()) {
+        vector<float> permuted_reals(reals.size());
+        for (uint32_t i = 0; i < points.size(); i++)
+            copy_n(reals.begin() + (size_t)order[i] * vector_size, vector_size, 
+                   permuted_reals.begin() + (size_t)i * vector_size);
+
+        reals = permuted_reals;
+    }
+
+    delete[] storage;
+    storage   = memory;
+    points    = permuted;
+    originals = permuted_originals;
+
+    labels.assign(issued, 0);
+    for (uint32_t i = 0; i < points.size(); i++)
+        labels[originals[i] - 1] = i + 1;
+}
+
+// Gives a point a new original label, past every one issued so far. Its previous original label maps to
+// no point anymore, so a reused slot can not be reached through the label of the point it replaced.
+uint32_t DataSet::renumber(uint32_t label) {
+    if (originals.empty()) {
+        for (uint32_t i = 1; i <= points.size(); i++) {
+            originals.push_back(i);
+            labels.push_back(i);
+        }
+    }
+
+    labels[originals[label - 1] - 1] = 0;
+    labels.push_back(label);
+    originals[label - 1] = labels.size();
+
+    return originals[label - 1];
+}
+
+uint32_t DataSet::original(uint32_t label) const { return originals.empty() ? label : originals[label - 1]; }
+uint32_t DataSet::label(uint32_t original) const {
+    if (original == 0 || original > (labels.empty() ? points.size() : labels.size()))
+        return 0;
+
+    return labels.empty() ? original : labels[original - 1];
+}
+
+bool DataSet::floating() const { return sq != nullptr; }
+const ScalarQuantizer* DataSet::quantizer() const { return sq; }
+const float* DataSet::real(uint32_t label) const { return floating() ? reals.data() + (size_t)(label - 1) * vector_size : nullptr; }
+
+// Exact L2 distance on the full precision vectors
+double DataSet::distance(const float* query, uint32_t label) const {
+    const float* vector = real(label);
+
+    double sum = 0;
+    for (uint32_t d = 0; d < vector_size; d++) {
+        double diff = (double)query[d] - (double)vector[d];
+        sum += diff * diff;
+    }
+
+    return sqrt(sum);
+}
+
 vector<DataPoint*>::iterator DataSet::begin() { return points.begin(); }
-vector<DataPoint*>::iterator DataSet::end() { return points.end(); }
\ No newline at end of file
+vector<DataPoint*>::iterator DataSet::end() { return points.end(); }
+
+
+/////////////////
+// Data Stream //
+/////////////////
+
+DataStream::DataStream(string path_) : path(path_), position(0) {
+    input.open(path.data(), ios::binary);
+
+    if (input.fail())
+        throw runtime_error("Exception during DataStream creation: " + path + " could not be opened!\n");
+
+    uint8_t magic[4];
+    uint32_t h, w;
+    input.read((char*)magic, 4);
+    input.read((char*)&count, 4);
+    input.read((char*)&h, 4);
+    input.read((char*)&w, 4);
+
+    if (magic[2] == FLOAT32 || magic[2] == FLOAT16)
+        throw runtime_error("Exception during DataStream creation: Only byte files can be streamed!\n");
+
+    count       = be32toh(count);
+    vector_size = be32toh(h) * be32toh(w);
+}
+
+uint32_t DataStream::dim() const { return vector_size; }
+uint32_t DataStream::size() const { return count; }
+
+uint32_t DataStream::read(uint8_t* buffer, uint32_t points) {
+    points = min(points, count - position);
+    input.read((char*)buffer, (size_t)points * vector_size);
+
+    if ((size_t)input.gcount() != (size_t)points * vector_size)
+        throw runtime_error("Exception during DataStream read: " + path + " is truncated!\n");
+
+    position += points;
+    return points;
+}
+
+// Back to the first point, past the 16 byte header
+void DataStream::rewind() {
+    input.clear();
+    input.seekg(16);
+    position = 0;
+}
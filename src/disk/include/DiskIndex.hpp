@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "utils.hpp"
+#include "Vector.hpp"
+#include "Graph.hpp"
+
+// Unit of every disk access, nodes never straddle a sector boundary
+#define SECTOR 4096
+
+// Single positioned read of a batch
+struct ReadRequest {
+    uint64_t offset;
+    uint32_t length;
+    uint8_t* buffer;
+};
+
+// Pool of threads issuing pread() calls, a batch returns once all of its reads have completed.
+// Every batch counts its own completions and failures, so concurrent callers only wait for their reads.
+// With no threads the reads are issued one after the other by the caller.
+class Reader {
+    private:
+        // Reads of a batch still in flight and reads that failed, owned by the caller of read( )
+        struct Completion {
+            uint32_t pending;
+            uint32_t failed;
+        };
+
+        int fd;
+        std::vector<std::thread> workers;
+        std::deque<std::pair<ReadRequest*, Completion*>> queue;
+        std::mutex lock;
+        std::condition_variable work;
+        std::condition_variable done;
+        bool stopping;
+
+        bool fetch(ReadRequest& request);
+        void loop();
+    public:
+        Reader(int fd, uint32_t threads);
+        ~Reader();
+
+        void read(std::vector<ReadRequest>& batch);
+};
+
+// Per query I/O statistics
+struct DiskStats {
+    uint32_t hops  = 0;     // Rounds of batched reads
+    uint32_t reads = 0;     // Nodes fetched from disk
+};
+
+// SSD-resident graph index: each node (full precision vector, degree and neighbour labels) is
+// stored in sector-aligned slots on disk, while 4-bit codes of the vectors stay in memory
+// to guide the beam search. The nodes fetched during the search are re-ranked exactly.
+//
+// File layout: [header sector][node sectors][code bounds and codes]
+class DiskIndex {
+    private:
+        int fd;
+        Reader* reader;
+
+        uint32_t count;
+        uint32_t dimension;
+        uint32_t degree;
+        uint32_t medoid;
+
+        uint32_t node_size;     // Bytes of a node
+        uint32_t per_sector;    // Nodes per sector, 0 if a node spans several sectors
+        uint32_t span;          // Sectors read for a single node
+
+        // 4-bit scalar quantization, two dimensions per byte
+        uint32_t code_size;
+        std::vector<float> lower;
+        std::vector<float> step;
+        std::vector<uint8_t> codes;
+
+        uint64_t offset(uint32_t label) const;
+        uint32_t position(uint32_t label) const;
+        void table(Vector<uint8_t>& query, std::vector<float>& out) const;
+        float approximate(const std::vector<float>& table, uint32_t label) const;
+    public:
+        DiskIndex(const std::string& path, uint32_t threads=4, bool direct=false);
+        ~DiskIndex();
+
+        uint32_t size() const;
+        uint32_t dim() const;
+        uint64_t memory() const;
+
+        std::vector<PAIR> search(Vector<uint8_t>& query, uint32_t N, uint32_t L, uint32_t W,
+                                 DiskStats* stats=nullptr);
+
+        static void write(const std::string& path, DataSet& dataset, Vamana& graph);
+};
+
+// Writes an IDX file of count clustered random vectors, one chunk at a time
+void synthesize(const std::string& path, uint32_t count, uint32_t dim, uint32_t clusters=64, uint32_t seed=1);
@@ -0,0 +1,194 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <sys/stat.h>
+
+#include "DiskIndex.hpp"
+#include "ArgParser.hpp"
+#include "Histogram.hpp"
+
+using namespace std;
+
+#define QUERIES 100
+
+
+// Exact N nearest neighbours by linear scan
+static vector<PAIR> exhaustive(DataSet& dataset, Vector<uint8_t>& query, uint32_t N) {
+    vector<PAIR> out;
+    for (auto point : dataset)
+        out.push_back(pair(point->label(), l2_distance(point->data(), query)));
+
+    N = min((size_t)N, out.size());
+    partial_sort(out.begin(), out.begin() + N, out.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+    out.resize(N);
+
+    return out;
+}
+
+
+int main(int argc, const char* argv[]) {
+try {
+    ArgParser parser = ArgParser();
+
+    parser.add("d", STRING);
+    parser.add("q", STRING);
+    parser.add("o", STRING);
+    parser.add("i", STRING);
+    parser.add("build", BOOL, "false");
+    parser.add("generate", UINT, "0");
+    parser.add("dim", UINT, "128");
+    parser.add("seed", UINT, "1");
+    parser.add("R", UINT, "32");
+    parser.add("Lc", UINT, "64");
+    parser.add("alpha", FLOAT, "1.2");
+    parser.add("N", UINT, "1");
+    parser.add("l", UINT, "50");
+    parser.add("W", UINT, "4");
+    parser.add("threads", UINT, "4");
+    parser.add("direct", BOOL, "false");
+    parser.parse(argc, argv);
+
+    uint32_t N       = parser.value<uint32_t>("N");
+    uint32_t L       = parser.value<uint32_t>("l");
+    uint32_t W       = parser.value<uint32_t>("W");
+    uint32_t threads = parser.value<uint32_t>("threads");
+    bool direct      = parser.value<bool>("direct");
+
+    Stopwatch timer;
+
+    // Synthetic dataset only, written without ever being held in memory
+    uint32_t generate = parser.value<uint32_t>("generate");
+    if (generate > 0) {
+        string path = parser.value<string>("d");
+        uint32_t dim = parser.value<uint32_t>("dim");
+
+        cout << "Generating " << generate << " vectors of " << dim << " dimensions... " << flush;
+        timer.start();
+        synthesize(path, generate, dim, 64, parser.value<uint32_t>("seed"));
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl;
+
+        return 0;
+    }
+
+    string index_path = parser.value<string>("i");
+
+    // The dataset is needed to build the index and, optionally, for the exact neighbours
+    DataSet* dataset = nullptr;
+    if (parser.parsed("d")) {
+        cout << "Loading input data... " << flush;
+        timer.start();
+        dataset = new DataSet(parser.value<string>("d"));
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl;
+    }
+
+    if (parser.value<bool>("build")) {
+        if (dataset == nullptr)
+            throw runtime_error("Building a disk index requires an input file (-d)!\n");
+
+        cout << "Creating Vamana graph... " << flush;
+        timer.start();
+        Vamana graph(*dataset, l2_distance, parser.value<uint32_t>("R"), parser.value<uint32_t>("Lc"),
+                     parser.value<float>("alpha"));
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl;
+
+        cout << "Writing disk index... " << flush;
+        timer.start();
+        DiskIndex::write(index_path, *dataset, graph);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl;
+    }
+
+    if (!parser.parsed("q")) {
+        delete dataset;
+        return 0;
+    }
+
+    cout << "Opening disk index... " << flush;
+    timer.start();
+    DiskIndex index(index_path, threads, direct);
+    cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl;
+
+    struct stat info;
+    stat(index_path.data(), &info);
+    cout << "Index: " << index.size() << " points, " << std::setprecision(1)
+         << info.st_size / 1048576. << " MB on disk, " << index.memory() / 1048576. << " MB in memory" << endl;
+
+    string out_path = parser.value<string>("o");
+    ofstream output_file(out_path, ios::out);
+    if (output_file.fail())
+        throw runtime_error(out_path + " could not be opened!\n");
+
+    cout << "Beginning search for \"" << parser.value<string>("q") << "\"... " << flush;
+    DataSet queries(parser.value<string>("q"), QUERIES);
+
+    double ttime = 0, tdist = 0, tdist_true = 0, recall = 0;
+    uint64_t hops = 0, reads = 0;
+    Histogram latency;
+
+    Stopwatch timer_out;
+    for (auto point : queries) {
+        DiskStats stats;
+
+        timer.start();
+        auto aknn = index.search(point->data(), N, L, W, &stats);
+        uint64_t elapsed = timer.elapsed();
+        ttime += elapsed / 1e9;
+        latency.record(elapsed);
+
+        hops  += stats.hops;
+        reads += stats.reads;
+
+        output_file << "Query " << point->label() << "\n";
+
+        if (dataset == nullptr) {
+            for (uint32_t i = 0; i < aknn.size(); i++) {
+                output_file << "Nearest neighbor-" << i << ": " << aknn[i].first << "\n";
+                output_file << "distanceApproximate: " << aknn[i].second << "\n";
+            }
+
+            output_file << "\n";
+            continue;
+        }
+
+        auto knn = exhaustive(*dataset, point->data(), N);
+
+        uint32_t hits = 0;
+        for (uint32_t i = 0; i < aknn.size() && i < knn.size(); i++) {
+            output_file << "Nearest neighbor-" << i << ": " << aknn[i].first << "\n";
+            output_file << "distanceApproximate: " << aknn[i].second << "\n";
+            output_file << "distanceTrue: " << knn[i].second << "\n";
+
+            tdist      += aknn[i].second;
+            tdist_true += knn[i].second;
+
+            hits += any_of(knn.begin(), knn.end(), [&](PAIR p) { return p.first == aknn[i].first; });
+        }
+
+        recall += (double)hits / knn.size();
+        output_file << "\n";
+    }
+
+    cout << "Done! (" << std::fixed << std::setprecision(3) << timer_out.stop() << " seconds)" << endl;
+
+    cout << "Average latency: " << std::fixed << std::setprecision(4) << ttime / queries.size() * 1000 << " ms, "
+         << std::setprecision(1) << (double)hops / queries.size() << " round trips, "
+         << (double)reads / queries.size() << " nodes read per query" << endl;
+
+    cout << "Latency ";
+    latency.report(cout);
+    cout << endl;
+
+    if (dataset != nullptr)
+        cout << "Approximation Factor: " << std::fixed << std::setprecision(4) << tdist / tdist_true
+             << ", Recall@" << N << ": " << recall / queries.size() << endl;
+
+    output_file.close();
+    delete dataset;
+
+}
+catch (exception& e) {
+    cerr << e.what();
+    return -1;
+}
+    return 0;
+}
@@ -0,0 +1,474 @@
+#include "DiskIndex.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <unordered_set>
+#include <random>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define DISK_MAGIC 0x4449534b
+
+// Aligned buffers, required by O_DIRECT
+struct Aligned {
+    uint8_t* data;
+    Aligned(size_t size) : data((uint8_t*)aligned_alloc(SECTOR, (size + SECTOR - 1) / SECTOR * SECTOR)) { }
+    ~Aligned() { free(data); }
+};
+
+
+////////////
+// Reader //
+////////////
+
+Reader::Reader(int fd_, uint32_t threads) : fd(fd_), stopping(false) {
+    for (uint32_t i = 0; i < threads; i++)
+        workers.emplace_back(&Reader::loop, this);
+}
+
+Reader::~Reader() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+
+    work.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+// Short reads past the end of the file are zero filled
+bool Reader::fetch(ReadRequest& request) {
+    uint32_t done = 0;
+
+    while (done < request.length) {
+        ssize_t bytes = pread(fd, request.buffer + done, request.length - done, request.offset + done);
+        if (bytes < 0)
+            return false;
+
+        if (bytes == 0) {
+            memset(request.buffer + done, 0, request.length - done);
+            break;
+        }
+
+        done += bytes;
+    }
+
+    return true;
+}
+
+void Reader::loop() {
+    unique_lock<mutex> guard(lock);
+
+    while (true) {
+        work.wait(guard, [&]() { return stopping || !queue.empty(); });
+
+        if (queue.empty())
+            break;
+
+        auto [request, completion] = queue.front();
+        queue.pop_front();
+
+        guard.unlock();
+        bool ok = fetch(*request);
+        guard.lock();
+
+        completion->failed += !ok;
+        if (--completion->pending == 0)
+            done.notify_all();
+    }
+}
+
+void Reader::read(vector<ReadRequest>& batch) {
+    if (workers.empty()) {
+        for (auto& request : batch) {
+            if (!fetch(request))
+                throw runtime_error("Exception in Reader: pread failed!\n");
+        }
+
+        return ;
+    }
+
+    Completion completion{ (uint32_t)batch.size(), 0 };
+
+    unique_lock<mutex> guard(lock);
+    for (auto& request : batch)
+        queue.push_back(pair(&request, &completion));
+
+    work.notify_all();
+
+    done.wait(guard, [&]() { return completion.pending == 0; });
+
+    if (completion.failed > 0)
+        throw runtime_error("Exception in Reader: pread failed!\n");
+}
+
+
+///////////////
+// DiskIndex //
+///////////////
+
+DiskIndex::DiskIndex(const string& path, uint32_t threads, bool direct) : reader(nullptr) {
+
+    fd = open(path.data(), O_RDONLY | (direct ? O_DIRECT : 0));
+
+    // Some file systems (e.g. tmpfs) do not support direct I/O
+    if (fd < 0 && direct) {
+        cerr << "Warning: " << path << " could not be opened for direct I/O, using the page cache" << endl;
+        fd = open(path.data(), O_RDONLY);
+    }
+
+    if (fd < 0)
+        throw runtime_error("Exception during DiskIndex creation: " + path + " could not be opened!\n");
+
+    // The reader threads and the descriptor are released if the file turns out not to be a valid index
+    try {
+        reader = new Reader(fd, threads);
+
+        Aligned header(SECTOR);
+        vector<ReadRequest> batch{ { 0, SECTOR, header.data } };
+        reader->read(batch);
+
+        uint32_t fields[8];
+        memcpy(fields, header.data, sizeof(fields));
+
+        if (fields[0] != DISK_MAGIC)
+            throw runtime_error("Exception during DiskIndex creation: " + path + " is not a disk index!\n");
+
+        count      = fields[1];
+        dimension  = fields[2];
+        degree     = fields[3];
+        medoid     = fields[4];
+        node_size  = fields[5];
+        per_sector = fields[6];
+        span       = fields[7];
+        code_size  = (dimension + 1) / 2;
+
+        // Only the quantizer and the codes are kept in memory
+        uint64_t sectors = per_sector > 0 ? (count + per_sector - 1) / per_sector : (uint64_t)count * span;
+        uint64_t length  = 2 * sizeof(float) * dimension + (uint64_t)count * code_size;
+
+        Aligned section(length);
+        batch.clear();
+        for (uint64_t done = 0; done < length; done += 1 << 30) {
+            uint32_t chunk = (min(length - done, (uint64_t)1 << 30) + SECTOR - 1) / SECTOR * SECTOR;
+            batch.push_back({ (1 + sectors) * SECTOR + done, chunk, section.data + done });
+        }
+        reader->read(batch);
+
+        lower.resize(dimension);
+        step.resize(dimension);
+        codes.resize((uint64_t)count * code_size);
+
+        memcpy(lower.data(), section.data, sizeof(float) * dimension);
+        memcpy(step.data(), section.data + sizeof(float) * dimension, sizeof(float) * dimension);
+        memcpy(codes.data(), section.data + 2 * sizeof(float) * dimension, codes.size());
+    }
+    catch (...) {
+        delete reader;
+        close(fd);
+        throw;
+    }
+}
+
+DiskIndex::~DiskIndex() {
+    delete reader;
+    close(fd);
+}
+
+uint32_t DiskIndex::size() const { return count; }
+uint32_t DiskIndex::dim() const { return dimension; }
+uint64_t DiskIndex::memory() const { return codes.size() + (lower.size() + step.size()) * sizeof(float); }
+
+// Start of the sector(s) holding the node
+uint64_t DiskIndex::offset(uint32_t label) const {
+    return per_sector > 0 ? (1 + (uint64_t)(label - 1) / per_sector) * SECTOR
+                          : (1 + (uint64_t)(label - 1) * span) * SECTOR;
+}
+
+// Position of the node inside its sector(s)
+uint32_t DiskIndex::position(uint32_t label) const {
+    return per_sector > 0 ? (label - 1) % per_sector * node_size : 0;
+}
+
+// Squared distances of the query to every pair of quantized dimensions, indexed by code byte
+void DiskIndex::table(Vector<uint8_t>& query, vector<float>& out) const {
+    out.assign((size_t)code_size * 256, 0);
+
+    float partial[2][16];
+    for (uint32_t b = 0; b < code_size; b++) {
+        for (uint32_t h = 0; h < 2; h++) {
+            uint32_t d = 2 * b + h;
+            for (uint32_t c = 0; c < 16; c++) {
+                float diff = d < dimension ? query[d] - (lower[d] + c * step[d]) : 0;
+                partial[h][c] = diff * diff;
+            }
+        }
+
+        for (uint32_t c = 0; c < 256; c++)
+            out[b * 256 + c] = partial[0][c & 15] + partial[1][c >> 4];
+    }
+}
+
+float DiskIndex::approximate(const vector<float>& table, uint32_t label) const {
+    const uint8_t* code = codes.data() + (uint64_t)(label - 1) * code_size;
+    const float* t = table.data();
+
+    float sum = 0;
+    for (uint32_t b = 0; b < code_size; b++, t += 256)
+        sum += t[code[b]];
+
+    return sum;
+}
+
+// Beam search: each round fetches the W closest unexpanded nodes of the pool with one batch of reads.
+// Neighbours enter the pool by their approximate (code) distance, while every fetched node is
+// also scored exactly, so that the closest N of them can be returned without any further I/O.
+vector<PAIR> DiskIndex::search(Vector<uint8_t>& query, uint32_t N, uint32_t L, uint32_t W, DiskStats* stats) {
+    if (query.len() != dimension)
+        throw runtime_error("Exception in DiskIndex search: Dimensions of vectors must match!\n");
+
+    L = max(L, N);
+    W = max(W, 1U);
+
+    vector<float> distances;
+    table(query, distances);
+
+    struct Candidate {
+        uint32_t label;
+        float distance;
+        bool expanded;
+    };
+
+    vector<Candidate> pool{ { medoid, approximate(distances, medoid), false } };
+    unordered_set<uint32_t> seen{ medoid };
+    vector<PAIR> exact;
+
+    Aligned buffer((size_t)W * span * SECTOR);
+    vector<ReadRequest> batch;
+    vector<uint32_t> labels;
+
+    while (true) {
+        batch.clear();
+        labels.clear();
+
+        for (auto& c : pool) {
+            if (labels.size() >= W)
+                break;
+
+            if (c.expanded)
+                continue;
+
+            c.expanded = true;
+            batch.push_back({ offset(c.label), span * SECTOR, buffer.data + labels.size() * span * SECTOR });
+            labels.push_back(c.label);
+        }
+
+        if (labels.empty())
+            break;
+
+        reader->read(batch);
+
+        if (stats != nullptr) {
+            stats->hops++;
+            stats->reads += labels.size();
+        }
+
+        for (uint32_t i = 0; i < labels.size(); i++) {
+            const uint8_t* node = batch[i].buffer + position(labels[i]);
+
+            double sum = 0;
+            for (uint32_t d = 0; d < dimension; d++) {
+                double diff = (double)node[d] - (double)query[d];
+                sum += diff * diff;
+            }
+            exact.push_back(pair(labels[i], sqrt(sum)));
+
+            uint32_t size;
+            memcpy(&size, node + dimension, sizeof(size));
+
+            for (uint32_t j = 0; j < size && j < degree; j++) {
+                uint32_t neighbour;
+                memcpy(&neighbour, node + dimension + sizeof(uint32_t) * (j + 1), sizeof(neighbour));
+
+                if (!seen.insert(neighbour).second)
+                    continue;
+
+                Candidate candidate{ neighbour, approximate(distances, neighbour), false };
+                if (pool.size() >= L && candidate.distance >= pool.back().distance)
+                    continue;
+
+                auto position = upper_bound(pool.begin(), pool.end(), candidate,
+                    [](const Candidate& c1, const Candidate& c2) { return c1.distance < c2.distance; });
+                pool.insert(position, candidate);
+
+                if (pool.size() > L)
+                    pool.pop_back();
+            }
+        }
+    }
+
+    sort(exact.begin(), exact.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+    if (exact.size() > N)
+        exact.resize(N);
+
+    return exact;
+}
+
+// Node layout: [vector (dim bytes)][number of neighbours (4 bytes)][neighbour labels (4 * degree bytes)]
+void DiskIndex::write(const string& path, DataSet& dataset, Vamana& graph) {
+    ofstream file(path, ios::binary);
+    if (file.fail())
+        throw runtime_error("Exception in DiskIndex write: " + path + " could not be opened!\n");
+
+    uint32_t count  = dataset.size();
+    uint32_t dim    = dataset.dim();
+    uint32_t degree = 0;
+
+    for (uint32_t i = 1; i <= count; i++)
+        degree = max(degree, (uint32_t)graph.neighbours(i).size());
+
+    uint32_t node_size  = dim + sizeof(uint32_t) * (degree + 1);
+    uint32_t per_sector = node_size <= SECTOR ? SECTOR / node_size : 0;
+    uint32_t span       = per_sector > 0 ? 1 : (node_size + SECTOR - 1) / SECTOR;
+
+    vector<char> header(SECTOR, 0);
+    uint32_t fields[8] = { DISK_MAGIC, count, dim, degree, graph.entry(), node_size, per_sector, span };
+    memcpy(header.data(), fields, sizeof(fields));
+    file.write(header.data(), SECTOR);
+
+    // Nodes are packed into sectors in label order
+    vector<char> block((size_t)span * SECTOR, 0);
+    uint32_t slots = per_sector > 0 ? per_sector : 1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        char* node = block.data() + (i % slots) * node_size;
+        auto point = dataset[i];
+        auto& pedges = graph.neighbours(point->label());
+
+        memcpy(node, point->data().get(), dim);
+
+        uint32_t size = pedges.size();
+        memcpy(node + dim, &size, sizeof(size));
+
+        for (uint32_t j = 0; j < size; j++) {
+            uint32_t label = pedges[j]->label();
+            memcpy(node + dim + sizeof(uint32_t) * (j + 1), &label, sizeof(label));
+        }
+
+        if ((i + 1) % slots == 0 || i + 1 == count) {
+            file.write(block.data(), block.size());
+            fill(block.begin(), block.end(), 0);
+        }
+    }
+
+    // Per dimension bounds, quantized to 16 levels
+    vector<float> lower(dim, FLT_MAX), step(dim, 0);
+    for (auto point : dataset) {
+        for (uint32_t d = 0; d < dim; d++) {
+            lower[d] = min(lower[d], (float)point->data()[d]);
+            step[d]  = max(step[d], (float)point->data()[d]);
+        }
+    }
+
+    for (uint32_t d = 0; d < dim; d++)
+        step[d] = max((step[d] - lower[d]) / 15, 1e-6f);
+
+    file.write((char*)lower.data(), sizeof(float) * dim);
+    file.write((char*)step.data(), sizeof(float) * dim);
+
+    vector<char> code((dim + 1) / 2);
+    for (auto point : dataset) {
+        fill(code.begin(), code.end(), 0);
+
+        for (uint32_t d = 0; d < dim; d++) {
+            uint8_t level = min(15L, lround((point->data()[d] - lower[d]) / step[d]));
+            code[d / 2] |= level << (4 * (d & 1));
+        }
+
+        file.write(code.data(), code.size());
+    }
+
+    // Pad to a whole sector, so that direct reads of the tail never go past the end of the file
+    uint64_t length = file.tellp();
+    vector<char> padding((SECTOR - length % SECTOR) % SECTOR, 0);
+    file.write(padding.data(), padding.size());
+
+    if (file.fail())
+        throw runtime_error("Exception in DiskIndex write: " + path + " could not be written!\n");
+
+    file.close();
+}
+
+
+///////////////
+// Synthetic //
+///////////////
+
+// Clusters of points spread along a few random directions around their center, plus small isotropic
+// noise, so that (as in real data) the intrinsic dimension is much lower than dim.
+// Written in the IDX format read by DataSet (rows = 1, columns = dim). The centers and directions
+// only depend on the seed, so that query files can be drawn from the same distribution.
+void synthesize(const string& path, uint32_t count, uint32_t dim, uint32_t clusters, uint32_t seed) {
+    ofstream file(path, ios::binary);
+    if (file.fail())
+        throw runtime_error("Exception in synthesize: " + path + " could not be opened!\n");
+
+    uint32_t header[4] = { htobe32(0x803), htobe32(count), htobe32(1), htobe32(dim) };
+    file.write((char*)header, sizeof(header));
+
+    const uint32_t rank = 8;
+
+    mt19937 seeded(seed);
+    uniform_real_distribution<float> position(64, 192);
+    normal_distribution<float> direction(0, 1. / sqrt(rank));
+
+    vector<float> centers((size_t)clusters * dim);
+    for (auto& c : centers)
+        c = position(seeded);
+
+    vector<float> bases((size_t)clusters * rank * dim);
+    for (auto& b : bases)
+        b = direction(seeded);
+
+    mt19937 gen(random_device{}());
+    uniform_int_distribution<uint32_t> pick(0, clusters - 1);
+    normal_distribution<float> spread(0, 32);
+    normal_distribution<float> noise(0, 4);
+
+    const uint32_t chunk = 1 << 16;
+    vector<char> buffer((size_t)chunk * dim);
+    vector<float> point(dim);
+
+    for (uint32_t done = 0; done < count; done += chunk) {
+        uint32_t size = min(chunk, count - done);
+
+        for (uint32_t i = 0; i < size; i++) {
+            uint32_t c = pick(gen);
+            copy(centers.begin() + (size_t)c * dim, centers.begin() + (size_t)(c + 1) * dim, point.begin());
+
+            for (uint32_t r = 0; r < rank; r++) {
+                float z = spread(gen);
+                const float* basis = bases.data() + ((size_t)c * rank + r) * dim;
+                for (uint32_t d = 0; d < dim; d++)
+                    point[d] += z * basis[d];
+            }
+
+            for (uint32_t d = 0; d < dim; d++)
+                buffer[(size_t)i * dim + d] = (uint8_t)min(255.f, max(0.f, roundf(point[d] + noise(gen))));
+        }
+
+        file.write(buffer.data(), (size_t)size * dim);
+    }
+
+    if (file.fail())
+        throw runtime_error("Exception in synthesize: " + path + " could not be written!\n");
+
+    file.close();
+}
@@ -4,46 +4,229 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
 
 #include "utils.hpp"
 #include "Approximator.hpp"
 #include "Vector.hpp"
+#include "PQ.hpp"
+#include "Sketch.hpp"
+
+// Node orderings for the locality pass: Reverse Cuthill-McKee or greedy Gorder-style windows
+typedef enum { RCM, GORDER } Ordering;
+
+// Search-time parameters, passed per query and independent of how the graph was built
+struct SearchParams {
+    uint32_t N      = 1;    // Number of nearest neighbours returned
+    uint32_t R      = 1;    // GNNS: random restarts
+    uint32_t T      = 10;   // GNNS: greedy steps per restart
+    uint32_t E      = 30;   // GNNS: neighbours expanded per step
+    uint32_t L      = 20;   // MRNG, Vamana: size of the candidate pool
+    uint32_t seeds  = 1;    // MRNG: entry points that seed the search
+    uint32_t ef     = 50;   // HNSW: beam width on layer 0
+    uint32_t rerank = 0;    // Search on the PQ codes and re-rank this many results exactly (0: exact search)
+    uint32_t hamming = 0;   // Skip neighbours whose sketches are this many bits farther from the query's than
+                            // the closest sketch seen so far (0: no prefilter)
+};
+
+// Distance of a query to the points of a graph: exact, or estimated on the PQ codes (ADC).
+// With sketches, near( ) rejects points by Hamming distance before any distance is computed.
+class Scorer {
+    private:
+        Vector<uint8_t>& query;
+        Distance<uint8_t, uint8_t> dist;
+        const PQ* codes;
+        std::vector<float> lookup;
+        const Sketch* sketch;
+        std::vector<uint64_t> code;
+        uint32_t slack;
+        mutable uint32_t closest;
+    public:
+        Scorer(Vector<uint8_t>& query, Distance<uint8_t, uint8_t> dist, const PQ* codes=nullptr,
+               const Sketch* sketch=nullptr, uint32_t slack=0);
+        double operator()(DataPoint* point) const;
+        bool near(DataPoint* point) const;
+};
 
 class Graph {
     protected:
         DataSet& dataset;
-        std::vector<DataPoint*>* edges;
+        std::vector<std::vector<DataPoint*>> edges;
         Distance<uint8_t, uint8_t> dist;
+        uint32_t degree;
+
+        // Optional compressed copy of the dataset, see SearchParams::rerank
+        PQ* codes;
+
+        // Optional binary sketches of the dataset, see SearchParams::hamming
+        Sketch* sketches;
+
+        // Tombstones, readers share the lock while writers hold it exclusively
+        std::vector<bool> deleted;
+        uint32_t removed;
+        std::shared_mutex access;
+
+        // Deleted labels still linked from the graph, in order of removal, and the labels that
+        // consolidation has unlinked, which insert( ) fills (under new original labels) before growing the dataset
+        std::vector<uint32_t> retired;
+        std::vector<uint32_t> vacant;
+
+        // Background consolidation of deleted nodes, one round at a time
+        std::mutex consolidating;
+        std::thread consolidator;
+        std::mutex signal;
+        std::condition_variable wake;
+        bool pending;
+        bool stopping;
+
+        void consolidation_loop();
+        void stop();
+
+        Scorer scorer(Vector<uint8_t>& query, const SearchParams& params) const;
+        std::vector<PAIR> candidates(Vector<uint8_t>& query, const SearchParams& params);
+        virtual std::vector<PAIR> search(Vector<uint8_t>& query, const SearchParams& params) = 0;
+        virtual std::vector<DataPoint*> prune(DataPoint* point, const std::vector<PAIR>& candidates);
+
+        // Insertion: per-node state of a new or reused slot (exclusive lock), the neighbour candidates on every
+        // layer of the point (shared lock) and the edges to and from them (exclusive lock)
+        virtual void allocate(uint32_t index);
+        virtual std::vector<std::vector<DataPoint*>> explore(DataPoint* point);
+        virtual void splice(DataPoint* point, const std::vector<std::vector<DataPoint*>>& found);
+        std::vector<PAIR> ranked(DataPoint* point, const std::vector<DataPoint*>& found, uint32_t layer);
+
+        // Layers of a node and their adjacency lists, as seen by consolidation (one layer by default)
+        virtual uint32_t layers(uint32_t index) const;
+        virtual std::vector<DataPoint*>& adjacency(uint32_t index, uint32_t layer);
+        virtual std::vector<DataPoint*> repair(DataPoint* point, const std::vector<PAIR>& candidates, uint32_t layer);
+        std::vector<DataPoint*> mend(uint32_t index, uint32_t layer);
+
+        // Moves the entry points off deleted nodes and forgets the edges of a vacated node,
+        // both called with the exclusive lock held
+        virtual void reenter();
+        virtual void vacate(uint32_t index);
+        uint32_t live(uint32_t label);
+
+        std::vector<uint32_t> order(Ordering method);
+        virtual void permute(const std::vector<uint32_t>& order);
     public:
-        Graph(DataSet& dataset, Distance<uint8_t, uint8_t> dist);
+        Graph(DataSet& dataset, Distance<uint8_t, uint8_t> dist, uint32_t degree);
         virtual ~Graph();
 
-        virtual std::vector<PAIR> query(Vector<uint8_t>& query, uint32_t N) = 0;
+        std::vector<PAIR> query(Vector<uint8_t>& query, const SearchParams& params);
+
+        uint32_t insert(Vector<uint8_t>& vector);
+        bool remove(uint32_t original);
+        void consolidate();
+        void reorder(Ordering method);
+        void compress(PQ* codes);
+        void prefilter(Sketch* sketches);
 
-        void save(const std::string& filename);
-        void load(const std::string& filename);
+        virtual void save(const std::string& filename);
+        virtual void load(const std::string& filename);
 };  
 
 
 class GNNS : public Graph{
-    private:
-        uint32_t R;
-        uint32_t T;
-        uint32_t E;
+    protected:
+        std::vector<PAIR> search(Vector<uint8_t>& query, const SearchParams& params) override;
     public:
         GNNS(DataSet& dataset, Approximator* approx, Distance<uint8_t, uint8_t> dist, 
-            uint32_t k, uint32_t R, uint32_t T, uint32_t E, std::string path="");
-        std::vector<PAIR> query(Vector<uint8_t>& query, uint32_t N) override;
+            uint32_t k, std::string path="");
+        ~GNNS();
 };  
 
 
 class MRNG : public Graph {
     private:
         uint32_t nn_of_centroid;
-        uint32_t L;
+
+        // Nearest nodes to k-means centroids, the closest of them start the search
+        std::vector<uint32_t> entry_points;
+
+        void enter(Distance<uint8_t, double> dist_centroid, uint32_t entries);
+    protected:
+        std::vector<PAIR> search(Vector<uint8_t>& query, const SearchParams& params) override;
+        std::vector<DataPoint*> prune(DataPoint* point, const std::vector<PAIR>& candidates) override;
+        void reenter() override;
+        void permute(const std::vector<uint32_t>& order) override;
     public:
         MRNG(DataSet& dataset_,  Approximator* approx, 
              Distance<uint8_t, uint8_t> dist, Distance<uint8_t, double> dist_centroid, 
-             uint32_t k, uint32_t L, std::string path="");
-        std::vector<PAIR> query(Vector<uint8_t>& query, uint32_t N);
+             uint32_t k, uint32_t entries, std::string path="");
+        ~MRNG();
+
+        void save(const std::string& filename) override;
+        void load(const std::string& filename) override;
+};
+
+
+class HNSW : public Graph {
+    private:
+        uint32_t M;
+        uint32_t efConstruction;
+        double mult;
+
+        uint32_t entry;
+        uint32_t max_level;
+        std::vector<uint32_t> levels;
+
+        // Edges of layers 1..levels[i] (layer 0 is kept in Graph::edges)
+        std::vector<std::vector<std::vector<DataPoint*>>> upper;
+        std::deque<std::mutex> locks;
+        std::mutex global;
+
+        std::vector<DataPoint*>& links(uint32_t index, uint32_t level);
+        std::vector<DataPoint*> neighbours(uint32_t index, uint32_t level);
+        std::vector<PAIR> search_layer(const Scorer& score, const std::vector<PAIR>& entries, 
+                                       uint32_t ef, uint32_t level);
+        std::vector<DataPoint*> select(const std::vector<PAIR>& candidates, uint32_t M);
+        void connect(DataPoint* point, const std::vector<PAIR>& candidates, uint32_t level);
+        void insert(DataPoint* point);
+    protected:
+        std::vector<PAIR> search(Vector<uint8_t>& query, const SearchParams& params) override;
+        std::vector<DataPoint*> prune(DataPoint* point, const std::vector<PAIR>& candidates) override;
+        void allocate(uint32_t index) override;
+        std::vector<std::vector<DataPoint*>> explore(DataPoint* point) override;
+        void splice(DataPoint* point, const std::vector<std::vector<DataPoint*>>& found) override;
+        uint32_t layers(uint32_t index) const override;
+        std::vector<DataPoint*>& adjacency(uint32_t index, uint32_t layer) override;
+        std::vector<DataPoint*> repair(DataPoint* point, const std::vector<PAIR>& candidates, uint32_t layer) override;
+        void reenter() override;
+        void vacate(uint32_t index) override;
+        void permute(const std::vector<uint32_t>& order) override;
+    public:
+        HNSW(DataSet& dataset, Distance<uint8_t, uint8_t> dist, 
+             uint32_t M, uint32_t efConstruction, std::string path="");
+        ~HNSW();
+
+        void save(const std::string& filename) override;
+        void load(const std::string& filename) override;
+};
+
+
+class Vamana : public Graph {
+    private:
+        uint32_t L;
+        double alpha;
+        uint32_t medoid;
+
+        std::vector<PAIR> greedy(const Scorer& score, uint32_t L, std::vector<PAIR>* visited=nullptr);
+        void pass(double alpha);
+    protected:
+        std::vector<PAIR> search(Vector<uint8_t>& query, const SearchParams& params) override;
+        std::vector<DataPoint*> prune(DataPoint* point, const std::vector<PAIR>& candidates) override;
+        void reenter() override;
+        void permute(const std::vector<uint32_t>& order) override;
+    public:
+        Vamana(DataSet& dataset, Distance<uint8_t, uint8_t> dist, 
+               uint32_t R, uint32_t L, double alpha, std::string path="");
+        ~Vamana();
+
+        // Read-only access for writing the graph out in other layouts
+        uint32_t entry() const;
+        const std::vector<DataPoint*>& neighbours(uint32_t label) const;
 };
\ No newline at end of file
@@ -1,16 +1,46 @@
 #include <iostream>
 #include <cfloat>
+#include <algorithm>
+#include <unordered_set>
+#include <linux/perf_event.h>
 
 #include "Graph.hpp"
+#include "cluster.hpp"
 #include "lsh.hpp"
 #include "cube.hpp"
 #include "ArgParser.hpp"
+#include "Histogram.hpp"
 
 using namespace std;
 
 #define QUERIES 100
 
 
+// Cache misses, the only event counted by profile( )
+static const vector<pair<uint32_t, uint64_t>> MISSES = { pair((uint32_t)PERF_TYPE_HARDWARE, 
+                                                              (uint64_t)PERF_COUNT_HW_CACHE_MISSES) };
+
+// Average latency (seconds) and cache misses of a query, measured after a warm-up pass
+static pair<double, double> profile(Graph* graph, DataSet& queries, const SearchParams& params) {
+    Stopwatch timer;
+    PerfGroup misses(MISSES);
+
+    for (auto point : queries)
+        graph->query(point->data(), params);
+
+    double time = 0, count = 0;
+    for (auto point : queries) {
+        misses.start();
+        timer.start();
+        graph->query(point->data(), params);
+        time  += timer.stop();
+        count += misses.stop()[0];
+    }
+
+    return pair(time / queries.size(), count / queries.size());
+}
+
+
 int main(int argc, const char* argv[]) {
 try {
     ArgParser parser = ArgParser();
@@ -23,10 +53,25 @@ try {
     parser.add("R", UINT, "1");
     parser.add("N", UINT, "1");
     parser.add("l", UINT, "20");
+    parser.add("M", UINT, "16");
+    parser.add("efC", UINT, "200");
+    parser.add("efS", UINT, "50");
+    parser.add("entries", UINT, "0");
+    parser.add("seeds", UINT, "1");
     parser.add("m", STRING);
     parser.add("a", STRING, "LSH");
     parser.add("save", STRING);
     parser.add("load", STRING);
+    parser.add("insert", STRING);
+    parser.add("delete", UINT, "0");
+    parser.add("reorder", STRING);
+    parser.add("pq", UINT, "0");
+    parser.add("ksub", UINT, "256");
+    parser.add("rerank", UINT, "0");
+    parser.add("sketch", UINT, "0");
+    parser.add("hamming", UINT, "0");
+    parser.add("survivors", UINT, "0");
+    parser.add("pivots", UINT, "0");
     parser.parse(argc, argv);
 
     string save_path = parser.parsed("save") ? parser.value<string>("save") : "";
@@ -34,11 +79,21 @@ try {
 
     
 	uint32_t k = parser.value<uint32_t>("k");
-	uint32_t E = parser.value<uint32_t>("E");
-	uint32_t R = parser.value<uint32_t>("R");
-    uint32_t T = 10;
-	uint32_t N = parser.value<uint32_t>("N");
-	uint32_t l = parser.value<uint32_t>("l");
+	uint32_t hnsw_M = parser.value<uint32_t>("M");
+	uint32_t efC = parser.value<uint32_t>("efC");
+	uint32_t entries = parser.value<uint32_t>("entries");
+
+    SearchParams params;
+    params.N     = parser.value<uint32_t>("N");
+    params.R     = parser.value<uint32_t>("R");
+    params.T     = 10;
+    params.E     = parser.value<uint32_t>("E");
+    params.L     = parser.value<uint32_t>("l");
+    params.seeds = parser.value<uint32_t>("seeds");
+    params.ef    = parser.value<uint32_t>("efS");
+    params.rerank = parser.value<uint32_t>("rerank");
+    params.hamming = parser.value<uint32_t>("hamming");
+    uint32_t N   = params.N;
     
     string approx_method = parser.value<string>("a");
 
@@ -77,12 +132,13 @@ try {
     if(parser.parsed("m"))
         graph_method = parser.value<string>("m");
     else{
-        cout << "Enter Graph method - 1 for GNNS, 2 for MRNG: " << flush;
+        cout << "Enter Graph method - 1 for GNNS, 2 for MRNG, 3 for HNSW: " << flush;
         getline(cin, graph_method);
-        if(graph_method != "1" && graph_method != "2")
-            throw runtime_error("Invalid Graph Method: Valid options are '1' for GNNS and '2' for MRNG");
     }
 
+    if(graph_method != "1" && graph_method != "2" && graph_method != "3")
+        throw runtime_error("Invalid Graph Method: Valid options are '1' for GNNS, '2' for MRNG and '3' for HNSW");
+
     
     Stopwatch timer, timer_out;
 
@@ -109,9 +165,11 @@ try {
     Graph* graph = 
     graph_method == "1" ? 
         (Graph*)new GNNS(train_dataset, approx_method == "LSH" ? (Approximator*)&lsh : (Approximator*)&cube, 
-                        l2_distance, k, R, T, E, load_path) :
+                        l2_distance, k, load_path) :
+    graph_method == "2" ?
         (Graph*)new MRNG(train_dataset, approx_method == "LSH" ? (Approximator*)&lsh : (Approximator*)&cube, 
-                         l2_distance, l2_distance, k, l, load_path);
+                         l2_distance, l2_distance, k, entries, load_path) :
+        (Graph*)new HNSW(train_dataset, l2_distance, hnsw_M, efC, load_path);
     cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
     
     if (!save_path.empty()) {
@@ -120,34 +178,139 @@ try {
         graph->save(save_path);
         cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
     }
+
+    PQ* codes = nullptr;
+    uint32_t pq = parser.value<uint32_t>("pq");
+    if (pq > 0) {
+        cout << "Training product quantizer (" << pq << " bytes per point)... " << flush;
+        timer.start();
+        codes = train_pq(train_dataset, pq, parser.value<uint32_t>("ksub"));
+        graph->compress(codes);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+    }
+
+    Sketch* sketches = nullptr;
+    uint32_t bits = parser.value<uint32_t>("sketch");
+    if (bits > 0) {
+        cout << "Computing sketches (" << bits << " bits per point)... " << flush;
+        timer.start();
+        sketches = new Sketch(train_dataset, bits);
+        graph->prefilter(sketches);
+
+        uint32_t survivors = parser.value<uint32_t>("survivors");
+        if (survivors > 0) {
+            lsh.prefilter(sketches, survivors);
+            cube.prefilter(sketches, survivors);
+        }
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+    }
+
+    if (parser.parsed("insert")) {
+        DataSet inserted(parser.value<string>("insert"));
+
+        cout << "Inserting " << inserted.size() << " points... " << flush;
+        timer.start();
+        for (auto point : inserted)
+            graph->insert(point->data());
+        double insert_time = timer.stop();
+        cout << "Done! (" << std::fixed << std::setprecision(3) << insert_time << " seconds, " 
+             << std::setprecision(6) << insert_time / inserted.size() << " per point)" << endl; 
+    }
+
+    // Labels of the input file deleted from the graph, the other searches still see them and skip them
+    unordered_set<uint32_t> removed;
+    auto live = [&](vector<PAIR>& out) {
+        out.erase(remove_if(out.begin(), out.end(), 
+                            [&](PAIR p) { return removed.count(train_dataset.original(p.first)) > 0; }), out.end());
+    };
+
+    uint32_t removals = parser.value<uint32_t>("delete");
+    if (removals > 0) {
+        cout << "Deleting " << removals << " points... " << flush;
+        timer.start();
+        Vector<uint32_t> labels(removals, UNIFORM, 1, train_dataset.size());
+        for (uint32_t i = 0; i < removals; i++) {
+            if (graph->remove(labels[i]))
+                removed.insert(labels[i]);
+        }
+        graph->consolidate();
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+    }
+
+    if (parser.parsed("reorder")) {
+        string method = parser.value<string>("reorder");
+        if (method != "RCM" && method != "Gorder")
+            throw runtime_error("Invalid Ordering: Valid options are 'RCM' and 'Gorder'");
+
+        DataSet queries(query_path, QUERIES);
+        auto before = profile(graph, queries, params);
+
+        cout << "Reordering graph (" << method << ")... " << flush;
+        timer.start();
+        graph->reorder(method == "RCM" ? RCM : GORDER);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+
+        auto after = profile(graph, queries, params);
+
+        cout << "Query latency before / after reordering: " << std::fixed << std::setprecision(4) 
+             << before.first * 1000 << " / " << after.first * 1000 << " ms" << endl;
+
+        if (PerfGroup(MISSES).available())
+            cout << "Cache misses per query before / after reordering: " << std::fixed << std::setprecision(0) 
+                 << before.second << " / " << after.second << endl;
+        else
+            cout << "Cache misses per query: hardware counters are not available" << endl;
+    }
+    
+    // The exact searches are pruned with a pivot table, built once the dataset is final
+    uint32_t pivot_count = parser.value<uint32_t>("pivots");
+    Pivots* pivots = nullptr;
+    if (pivot_count > 0) {
+        cout << "Computing pivot table (" << pivot_count << " pivots)... " << flush;
+        timer.start();
+        pivots = new Pivots(train_dataset, pivot_count);
+        lsh.prune(pivots);
+        cout << "Done! (" << std::fixed << std::setprecision(3) << timer.stop() << " seconds)" << endl; 
+    }
     
 	timer_out.start();
 	while (true) {
 	cout << "Beginning search for \"" << query_path << "\"... " << flush;
         double ttime_lsh = 0, ttime_cube = 0, ttime_graph = 0, ttime_true = 0;
         double tdist_lsh = 0, tdist_cube = 0, tdist_graph = 0, tdist_true = 0;
+        Histogram latency_lsh, latency_cube, latency_graph, latency_true;
 		for (auto point : DataSet(query_path, QUERIES)) {
 
 			timer.start();
-			auto aknn_graph = graph->query(point->data(), N);
-			double graph_time = timer.stop();
+			auto aknn_graph = graph->query(point->data(), params);
+			uint64_t graph_time = timer.elapsed();
+			latency_graph.record(graph_time);
 
 			timer.start();
 			auto aknn_lsh = lsh.kANN(*point, N, l2_distance<uint8_t>);
-			double lsh_time = timer.stop();
+			uint64_t lsh_time = timer.elapsed();
+			latency_lsh.record(lsh_time);
 
 			timer.start();
 			auto aknn_cube = cube.kANN(*point, N, l2_distance<uint8_t>);
-			double cube_time = timer.stop();
+			uint64_t cube_time = timer.elapsed();
+			latency_cube.record(cube_time);
 
 			timer.start();
-			auto knn = lsh.kNN(*point, N, l2_distance<uint8_t>);
-			double true_time = timer.stop();
-
-			ttime_graph += graph_time;
-			ttime_lsh   += lsh_time;
-			ttime_cube  += cube_time;
-			ttime_true  += true_time;
+			auto knn = lsh.kNN(*point, N + removed.size(), l2_distance<uint8_t>);
+			uint64_t true_time = timer.elapsed();
+			latency_true.record(true_time);
+
+			live(aknn_lsh);
+			live(aknn_cube);
+			live(knn);
+			if (knn.size() > N)
+				knn.resize(N);
+
+			ttime_graph += graph_time / 1e9;
+			ttime_lsh   += lsh_time / 1e9;
+			ttime_cube  += cube_time / 1e9;
+			ttime_true  += true_time / 1e9;
 			
 			output_file << "Query " << point->label() << "\n";
 
@@ -195,6 +358,20 @@ try {
         std::fixed << std::setprecision(4) << tdist_cube  / tdist_true << " / " << 
         std::fixed << std::setprecision(4) << tdist_graph / tdist_true << endl; 
 
+        cout << "Query latency:";
+        for (auto [name, latency] : { pair("LSH", &latency_lsh), pair("Cube", &latency_cube), 
+                                      pair("Graph", &latency_graph), pair("True", &latency_true) }) {
+            cout << endl << "  " << name << ": ";
+            latency->report(cout);
+        }
+        cout << endl;
+
+        if (pivots) {
+            cout << "Distances skipped by the pivot table: " << std::fixed << std::setprecision(2) 
+                 << 100 * pivots->rate() << "%" << endl;
+            pivots->reset();
+        }
+
 		cout << "\nEnter path to new query file (Nothing in order to stop): " << flush;
 		getline(cin, query_path);
 
@@ -204,6 +381,9 @@ try {
 	
 	output_file.close();
     delete graph;
+    delete codes;
+    delete sketches;
+    delete pivots;
 
 } 
 catch (exception& e) {
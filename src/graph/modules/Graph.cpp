@@ -1,6 +1,8 @@
 #include "Graph.hpp"
+#include "cluster.hpp"
 
 #include <omp.h>
+#include <cmath>
 #include <cfloat>
 #include <cassert>
 #include <vector>
@@ -9,13 +11,405 @@
 #include <set>
 #include <queue>
 #include <fstream>
+#include <algorithm>
 
 using namespace std;
 
-Graph::Graph(DataSet& dataset_, Distance<uint8_t, uint8_t> dist_) 
-: dataset(dataset_), edges(new vector<DataPoint*>[dataset.size()]), dist(dist_) { assert(dataset.size() > 0); }
+// Fraction of tombstones that triggers a background consolidation
+#define CONSOLIDATION_RATIO 0.05
 
-Graph::~Graph() { delete [] edges; }
+Scorer::Scorer(Vector<uint8_t>& query_, Distance<uint8_t, uint8_t> dist_, const PQ* codes_,
+               const Sketch* sketch_, uint32_t slack_)
+: query(query_), dist(dist_), codes(codes_), sketch(sketch_), slack(slack_), closest(UINT32_MAX - slack_) { 
+    if (codes != nullptr)
+        lookup = codes->table(query);
+
+    if (sketch != nullptr)
+        code = sketch->encode(query);
+}
+
+double Scorer::operator()(DataPoint* point) const {
+    return codes != nullptr ? sqrt(codes->distance(lookup, point->label())) : dist(query, point->data());
+}
+
+// The band follows the search: loose around the entry points, tight once it reaches the query's neighbourhood
+bool Scorer::near(DataPoint* point) const {
+    if (sketch == nullptr)
+        return true;
+
+    uint32_t hamming = sketch->distance(code.data(), point->label());
+    if (hamming > closest + slack)
+        return false;
+
+    closest = min(closest, hamming);
+    return true;
+}
+
+
+Graph::Graph(DataSet& dataset_, Distance<uint8_t, uint8_t> dist_, uint32_t degree_) 
+: dataset(dataset_), edges(dataset.size()), dist(dist_), degree(degree_), codes(nullptr), sketches(nullptr),
+  deleted(dataset.size(), false), removed(0), pending(false), stopping(false) { assert(dataset.size() > 0); }
+
+Graph::~Graph() { stop(); }
+
+// Joins the consolidation thread, called by every derived destructor since it dispatches virtual calls
+void Graph::stop() {
+    {
+        lock_guard<mutex> lock(signal);
+        stopping = true;
+    }
+
+    wake.notify_one();
+
+    if (consolidator.joinable())
+        consolidator.join();
+}
+
+
+vector<PAIR> Graph::query(Vector<uint8_t>& query, const SearchParams& params) {
+    shared_lock<shared_mutex> guard(access);
+
+    // Ask for some extra points to make up for the tombstones that are filtered out
+    uint32_t N = params.N;
+    SearchParams extended = params;
+    extended.N += min((uint32_t)retired.size(), N);
+
+    bool approximate = params.rerank > 0 && codes != nullptr;
+    if (approximate)
+        extended.N = max(extended.N, params.rerank);
+
+    auto out = search(query, extended);
+    out.erase(remove_if(out.begin(), out.end(), [&](PAIR p) { return deleted[p.first - 1]; }), out.end());
+
+    // Results ranked on the codes are re-scored exactly
+    if (approximate) {
+        for (auto& p : out)
+            p.second = dist(query, dataset[p.first - 1]->data());
+
+        sort(out.begin(), out.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+    }
+
+    if (out.size() > N)
+        out.resize(N);
+
+    // Report the labels of the input file, even if the graph has been reordered
+    for (auto& p : out)
+        p.first = dataset.original(p.first);
+
+    return out;
+}
+
+// Distances used by a search: on the codes if the graph is compressed and re-ranking is asked for,
+// with the sketch prefilter if the graph has sketches and a Hamming radius is given
+Scorer Graph::scorer(Vector<uint8_t>& query, const SearchParams& params) const {
+    return Scorer(query, dist, params.rerank > 0 ? codes : nullptr, 
+                  params.hamming > 0 ? sketches : nullptr, params.hamming);
+}
+
+// Live points found by the graph search, without locking
+vector<PAIR> Graph::candidates(Vector<uint8_t>& query, const SearchParams& params) {
+    auto out = search(query, params);
+    out.erase(remove_if(out.begin(), out.end(), [&](PAIR p) { return deleted[p.first - 1]; }), out.end());
+    return out;
+}
+
+// Default pruning keeps the closest "degree" candidates (candidates are sorted by distance to point)
+vector<DataPoint*> Graph::prune(DataPoint* point, const vector<PAIR>& candidates) {
+    vector<DataPoint*> out;
+
+    for (auto c : candidates) {
+        if (out.size() >= degree)
+            break;
+
+        if (c.first != point->label())
+            out.push_back(dataset[c.first - 1]);
+    }
+
+    return out;
+}
+
+void Graph::allocate(uint32_t) { }
+
+// Live points found by a graph search for the new point, on its single layer
+vector<vector<DataPoint*>> Graph::explore(DataPoint* point) {
+    SearchParams params;
+    params.N = params.L = params.ef = 2 * degree;
+    params.R = 10;
+
+    vector<DataPoint*> found;
+    for (auto c : candidates(point->data(), params))
+        found.push_back(dataset[c.first - 1]);
+
+    return { found };
+}
+
+// Candidates that are still live and can hold an edge on the layer, sorted by their distance to the point.
+// Distances are measured again, since a slot vacated and reused after the search holds another vector.
+vector<PAIR> Graph::ranked(DataPoint* point, const vector<DataPoint*>& found, uint32_t layer) {
+    vector<PAIR> out;
+
+    for (auto p : found) {
+        uint32_t index = p->label() - 1;
+        if (p != point && !deleted[index] && layers(index) > layer)
+            out.push_back(pair(p->label(), dist(point->data(), p->data())));
+    }
+
+    sort(out.begin(), out.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+    return out;
+}
+
+// Local repair: connect the new point to the pruned search results and connect them back
+void Graph::splice(DataPoint* point, const vector<vector<DataPoint*>>& found) {
+    auto& pedges = edges[point->label() - 1];
+    pedges = prune(point, ranked(point, found[0], 0));
+
+    auto closer = [](PAIR t1, PAIR t2) { return t1.second < t2.second; };
+
+    for (auto neighbour : pedges) {
+        auto& nedges = edges[neighbour->label() - 1];
+
+        vector<PAIR> candidates;
+        for (auto e : nedges)
+            candidates.push_back(pair(e->label(), dist(neighbour->data(), e->data())));
+        
+        candidates.push_back(pair(point->label(), dist(neighbour->data(), point->data())));
+        sort(candidates.begin(), candidates.end(), closer);
+
+        nedges = prune(neighbour, candidates);
+    }
+}
+
+// The point takes a new slot, or the slot of a consolidated deletion under a new original label. Only the
+// slot is set up under the exclusive lock: the search for its neighbours shares the lock with the queries,
+// and the exclusive lock is taken again to splice the edges in.
+uint32_t Graph::insert(Vector<uint8_t>& vector) {
+    DataPoint* point;
+
+    {
+        unique_lock<shared_mutex> guard(access);
+
+        if (vacant.empty()) {
+            point = dataset.add(vector);
+            edges.emplace_back();
+            deleted.push_back(false);
+
+            if (codes != nullptr)
+                codes->add(point->data());
+
+            if (sketches != nullptr)
+                sketches->add(point->data());
+        }
+        else {
+            point = dataset[vacant.back() - 1];
+            vacant.pop_back();
+
+            dataset.replace(point->label(), vector);
+            dataset.renumber(point->label());
+            deleted[point->label() - 1] = false;
+            removed--;
+
+            if (codes != nullptr)
+                codes->replace(point->label(), point->data());
+
+            if (sketches != nullptr)
+                sketches->replace(point->label(), point->data());
+        }
+
+        allocate(point->label() - 1);
+    }
+
+    // Nothing links to the point yet, so the queries running meanwhile do not see it
+    std::vector<std::vector<DataPoint*>> found;
+    {
+        shared_lock<shared_mutex> guard(access);
+        found = explore(point);
+    }
+
+    unique_lock<shared_mutex> guard(access);
+    splice(point, found);
+
+    return dataset.original(point->label());
+}
+
+bool Graph::remove(uint32_t original) {
+    {
+        unique_lock<shared_mutex> guard(access);
+
+        uint32_t label = dataset.label(original);
+        if (label == 0 || deleted[label - 1])
+            return false;
+
+        deleted[label - 1] = true;
+        removed++;
+        retired.push_back(label);
+
+        if (retired.size() < CONSOLIDATION_RATIO * (dataset.size() - removed))
+            return true;
+    }
+
+    lock_guard<mutex> lock(signal);
+    if (!consolidator.joinable())
+        consolidator = thread(&Graph::consolidation_loop, this);
+
+    pending = true;
+    wake.notify_one();
+
+    return true;
+}
+
+void Graph::consolidation_loop() {
+    unique_lock<mutex> lock(signal);
+
+    while (true) {
+        wake.wait(lock, [&]() { return stopping || pending; });
+
+        if (stopping)
+            break;
+
+        pending = false;
+
+        lock.unlock();
+        consolidate();
+        lock.lock();
+    }
+}
+
+uint32_t Graph::layers(uint32_t) const { return 1; }
+vector<DataPoint*>& Graph::adjacency(uint32_t index, uint32_t) { return edges[index]; }
+
+vector<DataPoint*> Graph::repair(DataPoint* point, const vector<PAIR>& candidates, uint32_t) {
+    return prune(point, candidates);
+}
+
+void Graph::reenter() { }
+void Graph::vacate(uint32_t index) { edges[index].clear(); }
+
+// The label itself if it is live, else its first live neighbour, else the first live point
+uint32_t Graph::live(uint32_t label) {
+    if (!deleted[label - 1])
+        return label;
+
+    for (auto p : edges[label - 1]) {
+        if (!deleted[p->label() - 1])
+            return p->label();
+    }
+
+    for (uint32_t i = 0; i < deleted.size(); i++) {
+        if (!deleted[i])
+            return i + 1;
+    }
+
+    return label;
+}
+
+// Edge list of a node on a layer with the deleted points replaced by their own live neighbours
+vector<DataPoint*> Graph::mend(uint32_t index, uint32_t layer) {
+    auto point = dataset[index];
+    auto& pedges = adjacency(index, layer);
+
+    unordered_set<uint32_t> seen{ point->label() };
+    vector<PAIR> candidates;
+
+    auto consider = [&](DataPoint* p) {
+        uint32_t index = p->label() - 1;
+        if (!deleted[index] && layers(index) > layer && seen.insert(p->label()).second)
+            candidates.push_back(pair(p->label(), dist(point->data(), p->data())));
+    };
+
+    for (auto neighbour : pedges) {
+        consider(neighbour);
+
+        if (deleted[neighbour->label() - 1]) {
+            for (auto p : adjacency(neighbour->label() - 1, layer))
+                consider(p);
+        }
+    }
+
+    sort(candidates.begin(), candidates.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+    return repair(point, candidates, layer);
+}
+
+// Replaces the edges towards deleted points with the live neighbours of those points, on every layer,
+// then unlinks the deleted points so that insert( ) can reuse their slots. The repaired lists are computed
+// under the shared lock, while queries go on, and swapped in under the exclusive lock. The few lists an
+// insertion changed in between are repaired again under the exclusive lock, so every round completes.
+void Graph::consolidate() {
+    typedef struct {
+        uint32_t index;
+        uint32_t layer;
+        vector<DataPoint*> before;
+        vector<DataPoint*> after;
+    } Repair;
+
+    lock_guard<mutex> round(consolidating);
+
+    vector<Repair> repairs;
+    size_t handled;
+
+    {
+        shared_lock<shared_mutex> guard(access);
+
+        handled = retired.size();
+        if (handled == 0)
+            return ;
+
+        #pragma omp parallel
+        {
+            vector<Repair> local;
+
+            #pragma omp for schedule(dynamic, 64) nowait
+            for (uint32_t i = 0; i < edges.size(); i++) {
+                if (deleted[i])
+                    continue;
+
+                for (uint32_t layer = 0; layer < layers(i); layer++) {
+                    auto& pedges = adjacency(i, layer);
+                    if (any_of(pedges.begin(), pedges.end(), [&](DataPoint* p) { return deleted[p->label() - 1]; }))
+                        local.push_back({ i, layer, pedges, mend(i, layer) });
+                }
+            }
+
+            #pragma omp critical
+            repairs.insert(repairs.end(), make_move_iterator(local.begin()), make_move_iterator(local.end()));
+        }
+    }
+
+    unique_lock<shared_mutex> guard(access);
+
+    for (auto& r : repairs) {
+        auto& pedges = adjacency(r.index, r.layer);
+        pedges = pedges == r.before ? move(r.after) : mend(r.index, r.layer);
+    }
+
+    reenter();
+
+    // Insertions only link live points, so nothing links to the points deleted before the repair anymore
+    for (size_t i = 0; i < handled; i++)
+        vacate(retired[i] - 1);
+
+    vacant.insert(vacant.end(), retired.begin(), retired.begin() + handled);
+    retired.erase(retired.begin(), retired.begin() + handled);
+}
+
+// Codes must follow the labels of the dataset, the graph does not take ownership
+void Graph::compress(PQ* codes_) {
+    unique_lock<shared_mutex> guard(access);
+
+    if (codes_ != nullptr && codes_->size() != dataset.size())
+        throw runtime_error("Exception in Graph compression: Codes must cover every point of the dataset!\n");
+
+    codes = codes_;
+}
+
+// Sketches must follow the labels of the dataset, the graph does not take ownership
+void Graph::prefilter(Sketch* sketches_) {
+    unique_lock<shared_mutex> guard(access);
+
+    if (sketches_ != nullptr && sketches_->size() != dataset.size())
+        throw runtime_error("Exception in Graph prefilter: Sketches must cover every point of the dataset!\n");
+
+    sketches = sketches_;
+}
 
 // Function to save the graph to a file
 void Graph::save(const string& filename) {
@@ -46,7 +440,7 @@ void Graph::load(const string& filename) {
 
     string line;
     uint32_t label;
-    for (size_t i = 0; getline(file, line); i++) {
+    for (size_t i = 0; i < edges.size() && getline(file, line); i++) {
         stringstream ss(line);
         while(ss >> label) {
             edges[i].push_back(dataset[label - 1]);
@@ -62,8 +456,8 @@ void Graph::load(const string& filename) {
 
 
 GNNS::GNNS(DataSet& dataset_, Approximator* approx, Distance<uint8_t, uint8_t> dist_, 
-         uint32_t k, uint32_t R_, uint32_t T_, uint32_t E_, string path) 
-: Graph(dataset_, dist_), R(R_), T(T_), E(E_) {    
+         uint32_t k, string path) 
+: Graph(dataset_, dist_, k) {    
 
     if (!path.empty()) {
         this->load(path);
@@ -77,7 +471,13 @@ GNNS::GNNS(DataSet& dataset_, Approximator* approx, Distance<uint8_t, uint8_t> d
     }
 }
 
-vector<PAIR>  GNNS::query(Vector<uint8_t>& query, uint32_t N) {
+GNNS::~GNNS() { stop(); }
+
+vector<PAIR>  GNNS::search(Vector<uint8_t>& query, const SearchParams& params) {
+    uint32_t R = params.R;
+    uint32_t T = params.T;
+    uint32_t E = params.E;
+    auto score = scorer(query, params);
 
     auto comparator = [](const PAIR t1, const PAIR t2) {
         return t1.second > t2.second;
@@ -102,8 +502,10 @@ vector<PAIR>  GNNS::query(Vector<uint8_t>& query, uint32_t N) {
             for (uint32_t i = 0; i < size; i++) {
                 
                 auto neighb = pedges[i];
+                if (!score.near(neighb))
+                    continue;
 
-                double distance = dist(query, neighb->data());
+                double distance = score(neighb);
 
                 if (distance < min_dist) {
                     closest = neighb;
@@ -128,7 +530,7 @@ vector<PAIR>  GNNS::query(Vector<uint8_t>& query, uint32_t N) {
 
 
     vector< PAIR > out;
-    for (uint32_t i = 0; !pq.empty() && i < N; i++) {
+    for (uint32_t i = 0; !pq.empty() && i < params.N; i++) {
 		out.push_back(pq.top());
 		pq.pop();
 	}
@@ -139,52 +541,30 @@ vector<PAIR>  GNNS::query(Vector<uint8_t>& query, uint32_t N) {
 
 MRNG::MRNG(DataSet& dataset_,  Approximator* approx, 
            Distance<uint8_t, uint8_t> dist_, Distance<uint8_t, double> dist_centroid, 
-           uint32_t k, uint32_t L_, string path)
-: Graph(dataset_, dist_), L(L_) {
+           uint32_t k, uint32_t entries, string path)
+: Graph(dataset_, dist_, std::max(50U, dataset_.size() / 100)), nn_of_centroid(0) {
     
     if (path.empty()) {
-
-        size_t overhead = std::max(50U, dataset.size() / 100);
-
         #pragma omp parallel for
-        for(auto x : dataset) {
-            
-            vector<PAIR> neighbors = approx->kNN(*x, k, dist);
-            size_t size = neighbors.size();
-
-            size_t i = 0;
-            size_t j = 0;
-            auto& pedges = edges[x->label() - 1];
-
-            while(i < size && j < overhead){
-                if (neighbors[i].first == x->label()) {
-                    i++;
-                    continue;
-                }
-                
-                DataPoint* y = dataset[neighbors[i].first - 1];
-                double min_dist = neighbors[i++].second;
-
-                bool insert = true;
-                for(auto r : pedges) {
-                    if(min_dist >= dist(r->data(), y->data())) {
-                        insert = false;
-                        break;
-                    }
-                }
-
-                if(insert) 
-                    pedges.push_back(y);
-                
-                j += insert;
-            }
-        }
+        for(auto x : dataset)
+            edges[x->label() - 1] = prune(x, approx->kNN(*x, k, dist));
     }
     else
         this->load(path);
-    
-    //
-    
+
+    // Entry points saved with the graph are kept, as long as there are as many as requested
+    if (entries < 2)
+        entry_points.clear();
+
+    if (nn_of_centroid == 0 || (entries >= 2 && entry_points.size() != entries)) {
+        entry_points.clear();
+        enter(dist_centroid, entries);
+    }
+}
+
+// The point closest to the centroid of the dataset and, with 2 entries or more, the members closest to the
+// centroids of a Lloyd clustering
+void MRNG::enter(Distance<uint8_t, double> dist_centroid, uint32_t entries) {
 	auto centroid = new Vector<double>(dataset[0]->data().len());
 
 	for (auto point : dataset)
@@ -202,9 +582,136 @@ MRNG::MRNG(DataSet& dataset_,  Approximator* approx,
 	}
 
 	delete centroid;
+
+    if (entries < 2)
+        return ;
+
+    // One entry point per k-means cluster: the member closest to the centroid
+    Lloyd lloyd(dataset, entries, dist_centroid);
+    lloyd.apply();
+
+    for (auto cluster : lloyd.get()) {
+        double min_dist = DBL_MAX;
+        uint32_t nearest = 0;
+
+        for (auto point : cluster->points()) {
+            double distance = dist_centroid(point->data(), cluster->center());
+            if (distance < min_dist) {
+                min_dist = distance;
+                nearest = point->label();
+            }
+        }
+
+        if (nearest != 0)
+            entry_points.push_back(nearest);
+    }
 }
 
-vector<PAIR> MRNG::query(Vector<uint8_t>& query, uint32_t N){
+// The entry points follow the edges, on a last line that starts with '@': the point closest to the centroid,
+// then the entry points of the clusters
+void MRNG::save(const string& filename) {
+    Graph::save(filename);
+
+    ofstream file(filename, ios::binary | ios::app);
+    if (!file.is_open()) {
+        cerr << "Error: Unable to open " << filename << " for writing." << endl;
+        return;
+    }
+
+    file << "@" << nn_of_centroid;
+    for (auto entry : entry_points)
+        file << "," << entry;
+    file << "\n";
+
+    file.close();
+}
+
+// Files without the line of the entry points leave them unset, the constructor computes them then
+void MRNG::load(const string& filename) {
+    Graph::load(filename);
+
+    ifstream file(filename, ios::binary);
+    if (!file.is_open())
+        return;
+
+    string line, last;
+    while (getline(file, line)) {
+        if (!line.empty())
+            last = line;
+    }
+
+    if (last.empty() || last[0] != '@')
+        return;
+
+    stringstream ss(last.substr(1));
+    ss >> nn_of_centroid;
+
+    uint32_t label;
+    while (ss.peek() == ',' && ss.ignore() && ss >> label)
+        entry_points.push_back(label);
+
+    // Labels of another dataset: computed again
+    auto valid = [&](uint32_t label) { return label != 0 && label <= dataset.size(); };
+    if (!valid(nn_of_centroid) || !all_of(entry_points.begin(), entry_points.end(), valid)) {
+        nn_of_centroid = 0;
+        entry_points.clear();
+    }
+
+    file.close();
+}
+
+MRNG::~MRNG() { stop(); }
+
+void MRNG::permute(const vector<uint32_t>& order) {
+    uint32_t original = dataset.original(nn_of_centroid);
+    vector<uint32_t> originals;
+    for (auto entry : entry_points)
+        originals.push_back(dataset.original(entry));
+
+    Graph::permute(order);
+
+    nn_of_centroid = dataset.label(original);
+    for (size_t i = 0; i < entry_points.size(); i++)
+        entry_points[i] = dataset.label(originals[i]);
+}
+
+// Deleted entry points hand over to a live neighbour before they are unlinked
+void MRNG::reenter() {
+    nn_of_centroid = live(nn_of_centroid);
+    for (auto& entry : entry_points)
+        entry = live(entry);
+}
+
+// An edge p -> y is kept only if y is closer to p than to every neighbour already placed
+vector<DataPoint*> MRNG::prune(DataPoint* x, const vector<PAIR>& neighbors) {
+    vector<DataPoint*> pedges;
+
+    for (size_t i = 0, size = neighbors.size(); i < size && pedges.size() < degree; i++) {
+        if (neighbors[i].first == x->label())
+            continue;
+        
+        DataPoint* y = dataset[neighbors[i].first - 1];
+        double min_dist = neighbors[i].second;
+
+        bool insert = true;
+        for(auto r : pedges) {
+            if(min_dist >= dist(r->data(), y->data())) {
+                insert = false;
+                break;
+            }
+        }
+
+        if(insert) 
+            pedges.push_back(y);
+    }
+
+    return pedges;
+}
+
+vector<PAIR> MRNG::search(Vector<uint8_t>& query, const SearchParams& params){
+    uint32_t L = params.L;
+    uint32_t N = params.N;
+    auto score = scorer(query, params);
 
     auto comparator = [](PAIR t1, PAIR t2) {
         return t1.second < t2.second;
@@ -215,8 +722,24 @@ vector<PAIR> MRNG::query(Vector<uint8_t>& query, uint32_t N){
     unordered_set<uint32_t> inserted;
 
 
-    R.insert(pair(nn_of_centroid, dist(dataset[nn_of_centroid - 1]->data(), query)));
-    inserted.insert(nn_of_centroid);
+    if (entry_points.empty()) {
+        R.insert(pair(nn_of_centroid, score(dataset[nn_of_centroid - 1])));
+        inserted.insert(nn_of_centroid);
+    }
+    else {
+        // Cheap scan over the entry points, the closest ones seed the search
+        vector<PAIR> entries;
+        for (auto entry : entry_points)
+            entries.push_back(pair(entry, score(dataset[entry - 1])));
+
+        uint32_t count = min((size_t)max(params.seeds, 1U), entries.size());
+        partial_sort(entries.begin(), entries.begin() + count, entries.end(), comparator);
+
+        for (uint32_t i = 0; i < count; i++) {
+            R.insert(entries[i]);
+            inserted.insert(entries[i].first);
+        }
+    }
 
     while(R.size() < L){
         uint32_t point = 0;
@@ -234,10 +757,10 @@ vector<PAIR> MRNG::query(Vector<uint8_t>& query, uint32_t N){
         considered.insert(point);
 
         for(auto neighbor : edges[point - 1]) {
-            if(inserted.find(neighbor->label()) != inserted.end())
+            if(inserted.find(neighbor->label()) != inserted.end() || !score.near(neighbor))
                 continue;
 
-            R.insert(pair(neighbor->label(), dist(query, neighbor->data())));
+            R.insert(pair(neighbor->label(), score(neighbor)));
             inserted.insert(neighbor->label());
         }
     }
@@ -0,0 +1,368 @@
+#include "Graph.hpp"
+
+#include <omp.h>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+
+using namespace std;
+
+HNSW::HNSW(DataSet& dataset_, Distance<uint8_t, uint8_t> dist_,
+           uint32_t M_, uint32_t efConstruction_, string path)
+: Graph(dataset_, dist_, 2 * max(M_, 2U)), M(max(M_, 2U)), efConstruction(efConstruction_),
+  mult(1. / log(M)), entry(1), max_level(0),
+  levels(dataset.size(), 0), upper(dataset.size()), locks(dataset.size()) {
+
+    if (!path.empty()) {
+        this->load(path);
+        return ;
+    }
+
+    // Exponentially decaying layer distribution, P(level >= l) = M^(-l)
+    Vector<float> u(dataset.size(), UNIFORM, 0, 1);
+    for (uint32_t i = 0; i < dataset.size(); i++) {
+        levels[i] = floor(-log(1. - u[i]) * mult);
+        upper[i].resize(levels[i]);
+    }
+
+    entry = dataset[0]->label();
+    max_level = levels[0];
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (uint32_t i = 1; i < dataset.size(); i++)
+        insert(dataset[i]);
+}
+
+HNSW::~HNSW() { stop(); }
+
+void HNSW::permute(const vector<uint32_t>& order) {
+    vector<uint32_t> permuted_levels(order.size());
+    vector<vector<vector<DataPoint*>>> permuted_upper(order.size());
+
+    for (uint32_t i = 0; i < order.size(); i++) {
+        permuted_levels[i] = levels[order[i]];
+        permuted_upper[i]  = upper[order[i]];
+    }
+
+    levels = permuted_levels;
+    upper  = permuted_upper;
+
+    // Locks are interchangeable, only the labels need to follow the permutation
+    uint32_t original = dataset.original(entry);
+    Graph::permute(order);
+    entry = dataset.label(original);
+}
+
+
+vector<DataPoint*>& HNSW::links(uint32_t index, uint32_t level) {
+    return level == 0 ? edges[index] : upper[index][level - 1];
+}
+
+// Copy of the adjacency list, safe to use while other threads insert
+vector<DataPoint*> HNSW::neighbours(uint32_t index, uint32_t level) {
+    lock_guard<mutex> lock(locks[index]);
+    return links(index, level);
+}
+
+// Beam search restricted on a single layer, returns at most ef points sorted by distance
+vector<PAIR> HNSW::search_layer(const Scorer& score, const vector<PAIR>& entries, uint32_t ef, uint32_t level) {
+
+    auto closer = [](const PAIR t1, const PAIR t2) {
+        return t1.second > t2.second;
+    };
+
+    auto further = [](const PAIR t1, const PAIR t2) {
+        return t1.second < t2.second;
+    };
+
+    priority_queue<PAIR, vector<PAIR>, decltype(closer)> candidates(closer);
+    priority_queue<PAIR, vector<PAIR>, decltype(further)> found(further);
+    unordered_set<uint32_t> visited;
+
+    for (auto e : entries) {
+        candidates.push(e);
+        found.push(e);
+        visited.insert(e.first);
+    }
+
+    while (found.size() > ef)
+        found.pop();
+
+    while (!candidates.empty()) {
+        auto current = candidates.top();
+
+        if (current.second > found.top().second)
+            break;
+
+        candidates.pop();
+
+        for (auto neighbour : neighbours(current.first - 1, level)) {
+            if (!visited.insert(neighbour->label()).second || !score.near(neighbour))
+                continue;
+
+            double distance = score(neighbour);
+
+            if (found.size() < ef || distance < found.top().second) {
+                candidates.push(pair(neighbour->label(), distance));
+                found.push(pair(neighbour->label(), distance));
+
+                if (found.size() > ef)
+                    found.pop();
+            }
+        }
+    }
+
+    vector<PAIR> out(found.size());
+    for (size_t i = found.size(); i-- > 0; found.pop())
+        out[i] = found.top();
+
+    return out;
+}
+
+// Neighbour selection heuristic: keep a candidate only if it is closer to the base point
+// than to every neighbour already selected (candidates sorted by distance to the base)
+vector<DataPoint*> HNSW::select(const vector<PAIR>& candidates, uint32_t M) {
+    vector<DataPoint*> out;
+
+    for (auto c : candidates) {
+        if (out.size() >= M)
+            break;
+
+        auto point = dataset[c.first - 1];
+
+        bool keep = true;
+        for (auto r : out) {
+            if (dist(point->data(), r->data()) < c.second) {
+                keep = false;
+                break;
+            }
+        }
+
+        if (keep)
+            out.push_back(point);
+    }
+
+    return out;
+}
+
+// Selection on layer 0
+vector<DataPoint*> HNSW::prune(DataPoint*, const vector<PAIR>& candidates) {
+    return select(candidates, 2 * M);
+}
+
+// Online insertion goes through the regular incremental construction, into a new or a vacated slot
+void HNSW::allocate(uint32_t index) {
+    uint32_t level = floor(-log(1. - Vector<float>(1, UNIFORM, 0, 1)[0]) * mult);
+
+    if (index == levels.size()) {
+        levels.push_back(level);
+        upper.emplace_back(level);
+        locks.emplace_back();
+    }
+    else {
+        levels[index] = level;
+        upper[index].assign(level, {});
+    }
+}
+
+// Search results of the descent on every layer of the point, from layer 0 up
+vector<vector<DataPoint*>> HNSW::explore(DataPoint* point) {
+    uint32_t level = levels[point->label() - 1];
+    Scorer score(point->data(), dist);
+
+    vector<PAIR> W{ pair(entry, score(dataset[entry - 1])) };
+
+    for (uint32_t l = max_level; l > level; l--)
+        W = search_layer(score, W, 1, l);
+
+    vector<vector<DataPoint*>> out(min(level, max_level) + 1);
+    for (int l = out.size() - 1; l >= 0; l--) {
+        W = search_layer(score, W, efConstruction, l);
+
+        for (auto p : W)
+            out[l].push_back(dataset[p.first - 1]);
+    }
+
+    return out;
+}
+
+void HNSW::splice(DataPoint* point, const vector<vector<DataPoint*>>& found) {
+    for (uint32_t l = 0; l < found.size(); l++)
+        connect(point, ranked(point, found[l], l), l);
+
+    uint32_t level = levels[point->label() - 1];
+    if (level > max_level) {
+        entry = point->label();
+        max_level = level;
+    }
+}
+
+uint32_t HNSW::layers(uint32_t index) const { return levels[index] + 1; }
+vector<DataPoint*>& HNSW::adjacency(uint32_t index, uint32_t layer) { return links(index, layer); }
+
+// Layer 0 keeps up to 2M neighbours, the upper layers M
+vector<DataPoint*> HNSW::repair(DataPoint*, const vector<PAIR>& candidates, uint32_t layer) {
+    return select(candidates, layer == 0 ? 2 * M : M);
+}
+
+// The live point on the highest layer becomes the entry point if the current one is deleted
+void HNSW::reenter() {
+    if (!deleted[entry - 1])
+        return ;
+
+    for (uint32_t i = 0; i < levels.size(); i++) {
+        if (!deleted[i] && (deleted[entry - 1] || levels[i] > max_level)) {
+            entry = i + 1;
+            max_level = levels[i];
+        }
+    }
+}
+
+void HNSW::vacate(uint32_t index) {
+    edges[index].clear();
+    upper[index].clear();
+    levels[index] = 0;
+}
+
+// Links the point to the selection of the candidates on a layer and connects them back
+void HNSW::connect(DataPoint* point, const vector<PAIR>& candidates, uint32_t l) {
+    uint32_t index = point->label() - 1;
+
+    auto selected = select(candidates, M);
+    {
+        lock_guard<mutex> lock(locks[index]);
+        links(index, l) = selected;
+    }
+
+    // Shrinking the neighbour's list if it overflows
+    uint32_t cap = l == 0 ? 2 * M : M;
+    for (auto neighbour : selected) {
+        uint32_t nindex = neighbour->label() - 1;
+
+        lock_guard<mutex> lock(locks[nindex]);
+        auto& nedges = links(nindex, l);
+        nedges.push_back(point);
+
+        if (nedges.size() <= cap)
+            continue;
+
+        vector<PAIR> candidates;
+        for (auto e : nedges)
+            candidates.push_back(pair(e->label(), dist(neighbour->data(), e->data())));
+
+        sort(candidates.begin(), candidates.end(), [](PAIR t1, PAIR t2) { return t1.second < t2.second; });
+        nedges = select(candidates, cap);
+    }
+}
+
+void HNSW::insert(DataPoint* point) {
+    uint32_t index = point->label() - 1;
+    uint32_t level = levels[index];
+    Scorer score(point->data(), dist);
+
+    // Points that raise the top layer keep the global lock until they become the entry point
+    unique_lock<mutex> guard(global);
+    uint32_t top = max_level;
+    uint32_t ep  = entry;
+
+    if (level <= top)
+        guard.unlock();
+
+    vector<PAIR> W{ pair(ep, score(dataset[ep - 1])) };
+
+    for (uint32_t l = top; l > level; l--)
+        W = search_layer(score, W, 1, l);
+
+    for (int l = min(level, top); l >= 0; l--) {
+        W = search_layer(score, W, efConstruction, l);
+        W.erase(remove_if(W.begin(), W.end(), [&](PAIR p) { return p.first == point->label(); }), W.end());
+        connect(point, W, l);
+    }
+
+    if (level > top) {
+        entry = point->label();
+        max_level = level;
+    }
+}
+
+vector<PAIR> HNSW::search(Vector<uint8_t>& query, const SearchParams& params) {
+    uint32_t N = params.N;
+    auto score = scorer(query, params);
+
+    vector<PAIR> W{ pair(entry, score(dataset[entry - 1])) };
+
+    // Greedy descent through the upper layers
+    for (uint32_t l = max_level; l > 0; l--)
+        W = search_layer(score, W, 1, l);
+
+    W = search_layer(score, W, max(params.ef, N), 0);
+
+    if (W.size() > N)
+        W.resize(N);
+
+    return W;
+}
+
+
+// Each line: <level>|<layer 0 edges>|<layer 1 edges>|...
+void HNSW::save(const string& filename) {
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error: Unable to open " << filename << " for writing." << endl;
+        return;
+    }
+
+    for (uint32_t i = 0; i < dataset.size(); i++) {
+        file << levels[i];
+
+        for (uint32_t l = 0; l <= levels[i]; l++) {
+            const auto& pedges = links(i, l);
+            file << "|";
+            for (size_t j = 0; j < pedges.size(); j++)
+                file << pedges[j]->label() << (j + 1 == pedges.size() ? "" : ",");
+        }
+
+        file << "\n";
+    }
+
+    file.close();
+}
+
+void HNSW::load(const string& filename) {
+
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error: Unable to open file for reading." << endl;
+        return;
+    }
+
+    string line, layer;
+    uint32_t label;
+    for (uint32_t i = 0; i < dataset.size() && getline(file, line); i++) {
+        stringstream ls(line);
+
+        getline(ls, layer, '|');
+        levels[i] = stoul(layer);
+        upper[i].resize(levels[i]);
+
+        if (i == 0 || levels[i] > max_level) {
+            entry = i + 1;
+            max_level = levels[i];
+        }
+
+        for (uint32_t l = 0; l <= levels[i] && getline(ls, layer, '|'); l++) {
+            stringstream ss(layer);
+            while (ss >> label) {
+                links(i, l).push_back(dataset[label - 1]);
+
+                if (ss.peek() == ',')
+                    ss.ignore();
+            }
+        }
+    }
+
+    file.close();
+}
@@ -0,0 +1,165 @@
+#include "Graph.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+// Size of the sliding window of recently placed nodes used by the Gorder-style ordering
+#define WINDOW 5
+
+// Returns order, where order[i] is the index of the node to be placed at position i
+vector<uint32_t> Graph::order(Ordering method) {
+    uint32_t size = edges.size();
+
+    vector<uint32_t> out;
+    vector<bool> placed(size, false);
+    out.reserve(size);
+
+    if (method == RCM) {
+
+        // Roots of the BFS trees are picked in ascending degree order
+        vector<uint32_t> nodes(size);
+        for (uint32_t i = 0; i < size; i++)
+            nodes[i] = i;
+
+        auto lighter = [&](uint32_t a, uint32_t b) { return edges[a].size() < edges[b].size(); };
+        stable_sort(nodes.begin(), nodes.end(), lighter);
+
+        queue<uint32_t> frontier;
+        for (auto root : nodes) {
+            if (placed[root])
+                continue;
+
+            placed[root] = true;
+            frontier.push(root);
+
+            while (!frontier.empty()) {
+                uint32_t node = frontier.front();
+                frontier.pop();
+                out.push_back(node);
+
+                vector<uint32_t> next;
+                for (auto neighbour : edges[node]) {
+                    uint32_t index = neighbour->label() - 1;
+                    if (!placed[index]) {
+                        placed[index] = true;
+                        next.push_back(index);
+                    }
+                }
+
+                stable_sort(next.begin(), next.end(), lighter);
+                for (auto index : next)
+                    frontier.push(index);
+            }
+        }
+
+        reverse(out.begin(), out.end());
+        return out;
+    }
+
+    // Gorder: greedily place the node with the most links (in either direction)
+    // to the last WINDOW placed nodes, falling back to the heaviest unplaced node
+    vector<vector<uint32_t>> incoming(size);
+    for (uint32_t i = 0; i < size; i++) {
+        for (auto neighbour : edges[i])
+            incoming[neighbour->label() - 1].push_back(i);
+    }
+
+    vector<uint32_t> fallback(size);
+    for (uint32_t i = 0; i < size; i++)
+        fallback[i] = i;
+
+    stable_sort(fallback.begin(), fallback.end(), [&](uint32_t a, uint32_t b) {
+        return incoming[a].size() + edges[a].size() > incoming[b].size() + edges[b].size();
+    });
+
+    unordered_map<uint32_t, int32_t> score;
+
+    auto bump = [&](uint32_t node, int32_t delta) {
+        auto update = [&](uint32_t index) {
+            if (placed[index])
+                return ;
+
+            if ((score[index] += delta) <= 0)
+                score.erase(index);
+        };
+
+        for (auto neighbour : edges[node])
+            update(neighbour->label() - 1);
+
+        for (auto index : incoming[node])
+            update(index);
+    };
+
+    for (uint32_t i = 0, next = 0; i < size; i++) {
+        uint32_t node;
+
+        if (score.empty()) {
+            while (placed[fallback[next]])
+                next++;
+
+            node = fallback[next];
+        }
+        else {
+            auto best = score.begin();
+            for (auto it = score.begin(); it != score.end(); it++) {
+                if (it->second > best->second)
+                    best = it;
+            }
+
+            node = best->first;
+        }
+
+        placed[node] = true;
+        score.erase(node);
+        out.push_back(node);
+
+        bump(node, 1);
+        if (out.size() > WINDOW)
+            bump(out[out.size() - 1 - WINDOW], -1);
+    }
+
+    return out;
+}
+
+// Rearranges the per-node state in the new order and relabels the dataset accordingly.
+// Adjacency lists are copied in order, so that they are also allocated close to each other.
+void Graph::permute(const vector<uint32_t>& order) {
+    vector<vector<DataPoint*>> permuted(order.size());
+    vector<bool> permuted_deleted(order.size());
+
+    for (uint32_t i = 0; i < order.size(); i++) {
+        permuted[i] = edges[order[i]];
+        permuted_deleted[i] = deleted[order[i]];
+    }
+
+    edges   = permuted;
+    deleted = permuted_deleted;
+
+    // Point order[i] takes label i + 1
+    vector<uint32_t> position(order.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+        position[order[i]] = i + 1;
+
+    for (auto& label : retired)
+        label = position[label - 1];
+
+    for (auto& label : vacant)
+        label = position[label - 1];
+
+    if (codes != nullptr)
+        codes->permute(order);
+
+    if (sketches != nullptr)
+        sketches->permute(order);
+
+    dataset.permute(order);
+}
+
+// Offline locality pass: neighbours get nearby ids, so that consecutive hops touch nearby
+// adjacency lists and vectors. Query results keep reporting the original labels.
+void Graph::reorder(Ordering method) {
+    unique_lock<shared_mutex> guard(access);
+    permute(order(method));
+}
@@ -0,0 +1,188 @@
+#include "Graph.hpp"
+
+#include <cfloat>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+Vamana::Vamana(DataSet& dataset_, Distance<uint8_t, uint8_t> dist_,
+               uint32_t R, uint32_t L_, double alpha_, string path)
+: Graph(dataset_, dist_, R), L(max(L_, R)), alpha(1.), medoid(1) {
+
+    // The search always starts from the point closest to the mean of the dataset
+    Vector<double> centroid(dataset.dim());
+    for (auto point : dataset)
+        centroid += point->data();
+
+    centroid /= (double)dataset.size();
+
+    double min_dist = DBL_MAX;
+    for (auto point : dataset) {
+        double distance = l2_distance(point->data(), centroid);
+        if (distance < min_dist) {
+            min_dist = distance;
+            medoid = point->label();
+        }
+    }
+
+    if (!path.empty()) {
+        this->load(path);
+        alpha = alpha_;
+        return ;
+    }
+
+    // Random R-regular starting graph, refined by a pass with alpha = 1 and one with the given alpha
+    uint32_t size = dataset.size();
+    for (uint32_t i = 0; i < size; i++) {
+        Vector<uint32_t> random(min(degree, size - 1), UNIFORM, 0, size - 1);
+        for (uint32_t j = 0; j < random.len(); j++) {
+            if (random[j] != i)
+                edges[i].push_back(dataset[random[j]]);
+        }
+    }
+
+    pass(1.);
+    pass(alpha_);
+}
+
+Vamana::~Vamana() { stop(); }
+
+uint32_t Vamana::entry() const { return medoid; }
+const vector<DataPoint*>& Vamana::neighbours(uint32_t label) const { return edges[label - 1]; }
+
+void Vamana::permute(const vector<uint32_t>& order) {
+    uint32_t original = dataset.original(medoid);
+    Graph::permute(order);
+    medoid = dataset.label(original);
+}
+
+void Vamana::reenter() { medoid = live(medoid); }
+
+// Every point, in random order, is linked to the pruned set of nodes visited while searching for it
+void Vamana::pass(double alpha_) {
+    alpha = alpha_;
+
+    vector<uint32_t> order(dataset.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    shuffle(order.begin(), order.end(), mt19937(random_device{}()));
+
+    auto closer = [](PAIR t1, PAIR t2) { return t1.second < t2.second; };
+
+    for (auto index : order) {
+        auto point = dataset[index];
+
+        vector<PAIR> visited;
+        greedy(Scorer(point->data(), dist), L, &visited);
+
+        unordered_set<uint32_t> seen;
+        for (auto p : visited)
+            seen.insert(p.first);
+
+        for (auto neighbour : edges[index]) {
+            if (seen.insert(neighbour->label()).second)
+                visited.push_back(pair(neighbour->label(), dist(point->data(), neighbour->data())));
+        }
+
+        sort(visited.begin(), visited.end(), closer);
+        edges[index] = prune(point, visited);
+
+        // Connect back, pruning the lists that overflow
+        for (auto neighbour : edges[index]) {
+            auto& nedges = edges[neighbour->label() - 1];
+
+            if (find(nedges.begin(), nedges.end(), point) != nedges.end())
+                continue;
+
+            if (nedges.size() < degree) {
+                nedges.push_back(point);
+                continue;
+            }
+
+            vector<PAIR> candidates;
+            for (auto e : nedges)
+                candidates.push_back(pair(e->label(), dist(neighbour->data(), e->data())));
+
+            candidates.push_back(pair(point->label(), dist(neighbour->data(), point->data())));
+            sort(candidates.begin(), candidates.end(), closer);
+
+            nedges = prune(neighbour, candidates);
+        }
+    }
+}
+
+// Robust pruning: a candidate y is dropped if some kept neighbour r is alpha times closer to it than p is
+vector<DataPoint*> Vamana::prune(DataPoint* point, const vector<PAIR>& candidates) {
+    vector<DataPoint*> out;
+
+    for (auto c : candidates) {
+        if (out.size() >= degree)
+            break;
+
+        if (c.first == point->label())
+            continue;
+
+        auto y = dataset[c.first - 1];
+
+        bool keep = true;
+        for (auto r : out) {
+            if (alpha * dist(r->data(), y->data()) <= c.second) {
+                keep = false;
+                break;
+            }
+        }
+
+        if (keep)
+            out.push_back(y);
+    }
+
+    return out;
+}
+
+// Best-first search from the medoid, the pool keeps the L closest points found so far.
+// Returns the pool sorted by distance and, optionally, every node that was expanded.
+vector<PAIR> Vamana::greedy(const Scorer& score, uint32_t L, vector<PAIR>* visited) {
+    auto closer = [](PAIR t1, PAIR t2) { return t1.second < t2.second; };
+
+    vector<PAIR> pool{ pair(medoid, score(dataset[medoid - 1])) };
+    unordered_set<uint32_t> seen{ medoid };
+    unordered_set<uint32_t> expanded;
+
+    while (true) {
+        auto next = find_if(pool.begin(), pool.end(), [&](PAIR p) { return !expanded.count(p.first); });
+        if (next == pool.end())
+            break;
+
+        PAIR current = *next;
+        expanded.insert(current.first);
+
+        if (visited != nullptr)
+            visited->push_back(current);
+
+        for (auto neighbour : edges[current.first - 1]) {
+            if (!seen.insert(neighbour->label()).second || !score.near(neighbour))
+                continue;
+
+            PAIR candidate = pair(neighbour->label(), score(neighbour));
+            if (pool.size() >= L && candidate.second >= pool.back().second)
+                continue;
+
+            pool.insert(upper_bound(pool.begin(), pool.end(), candidate, closer), candidate);
+            if (pool.size() > L)
+                pool.pop_back();
+        }
+    }
+
+    return pool;
+}
+
+vector<PAIR> Vamana::search(Vector<uint8_t>& query, const SearchParams& params) {
+    auto out = greedy(scorer(query, params), max(params.L, params.N));
+
+    if (out.size() > params.N)
+        out.resize(params.N);
+
+    return out;
+}
@@ -0,0 +1,298 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <vector>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "utils.hpp"
+#include "ArgParser.hpp"
+#include "HashTable.hpp"
+#include "lsh_hash.hpp"
+#include "cube_hash.hpp"
+
+// Vectors cycled through by the kernels, about 800 KB at 784 dimensions
+#define POOL 1024
+
+// Parameters of the hashes, as in bench.conf
+#define WINDOW 2600
+#define LSH_K  4
+#define CUBE_K 7
+
+// Candidates ranked per top-k call and neighbours kept
+#define CANDIDATES 1000
+#define TOP 10
+
+// Target length of a repetition
+#define REPETITION_NS 20000000
+
+using namespace std;
+
+static uint32_t repetitions;
+static uint64_t warmup_ns;
+
+typedef struct {
+    string kernel;
+    uint32_t dim;       // 0 for kernels that do not depend on it
+    double ns;          // Median over the repetitions
+    double fastest;     // Best repetition
+    double ticks;       // Time stamp counter ticks (reference, not core cycles), median
+    double bytes;       // Bytes of input read per operation
+    double spread;      // (slowest - fastest) / median
+} Measurement;
+
+static inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Makes the compiler assume the value is used, without storing it
+template <typename T>
+static inline void keep(const T& value) { asm volatile("" : : "r,m"(value) : "memory"); }
+
+// Calls "body", which returns the number of operations it performed, for the warmup time, then sizes the
+// repetitions to about REPETITION_NS each. Per-operation figures are the median over the repetitions;
+// a repetition that performed no operation (e.g. only empty buckets) is left out.
+template <typename F>
+static Measurement measure(string kernel, uint32_t dim, double bytes, F body) {
+    Stopwatch clock;
+
+    uint64_t calls = 0;
+    clock.start();
+    do {
+        body();
+        calls++;
+    } while (clock.elapsed() < warmup_ns);
+
+    uint64_t iterations = max((uint64_t)1, REPETITION_NS * calls / max(clock.elapsed(), (uint64_t)1));
+
+    vector<double> ns, tsc;
+    for (uint32_t r = 0; r < repetitions; r++) {
+        uint64_t ops = 0;
+
+        clock.start();
+        uint64_t start = ticks();
+        for (uint64_t i = 0; i < iterations; i++)
+            ops += body();
+
+        uint64_t elapsed = ticks() - start;
+        if (ops == 0)
+            continue;
+
+        tsc.push_back((double)elapsed / ops);
+        ns.push_back((double)clock.elapsed() / ops);
+    }
+
+    if (ns.empty())
+        throw runtime_error("Exception in " + kernel + ": No operation was performed!\n");
+
+    sort(ns.begin(), ns.end());
+    sort(tsc.begin(), tsc.end());
+
+    double median = ns[ns.size() / 2];
+    return { kernel, dim, median, ns[0], tsc[tsc.size() / 2], bytes, (ns.back() - ns[0]) / median };
+}
+
+// CSV field in quotes, with its own quotes doubled: kernel names contain commas
+static string field(const string& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"')
+            out += '"';
+        out += c;
+    }
+
+    return out + "\"";
+}
+
+// Hashes, distances and bucket scans at one dimension, on uniformly random points
+static void kernels(uint32_t dim, vector<Measurement>& out) {
+    DataSet data(dim);
+    for (uint32_t i = 0; i < POOL; i++)
+        data.add(Vector<uint8_t>(Vector<uint32_t>(dim, UNIFORM, 0, UINT8_MAX)));
+
+    Vector<double> center(dim, UNIFORM, 0, UINT8_MAX);
+    uint32_t next = 0;
+
+    out.push_back(measure("l2_distance<uint8_t, uint8_t>", dim, 2. * dim, [&]() {
+        keep(l2_distance(data[next]->data(), data[(next + 1) % POOL]->data()));
+        next = (next + 1) % POOL;
+        return 1;
+    }));
+
+    out.push_back(measure("l2_distance<uint8_t, double>", dim, 9. * dim, [&]() {
+        keep(l2_distance(data[next]->data(), center));
+        next = (next + 1) % POOL;
+        return 1;
+    }));
+
+    // A point and the float projections
+    LshHash lsh(dim, WINDOW);
+    out.push_back(measure("LshHash::apply", dim, 5. * dim, [&]() {
+        keep(lsh.apply(data[next]->data()));
+        next = (next + 1) % POOL;
+        return 1;
+    }));
+
+    LshAmplifiedHash amplified(dim, WINDOW, LSH_K);
+    out.push_back(measure("LshAmplifiedHash::apply (k=" + to_string(LSH_K) + ")", dim, (1. + 4 * LSH_K) * dim, [&]() {
+        keep(amplified.apply(data[next]->data()));
+        next = (next + 1) % POOL;
+        return 1;
+    }));
+
+    CubeHash cube(dim, WINDOW, CUBE_K);
+    out.push_back(measure("CubeHash::apply (k=" + to_string(CUBE_K) + ")", dim, (1. + 4 * CUBE_K) * dim, [&]() {
+        keep(cube.apply(data[next]->data()));
+        next = (next + 1) % POOL;
+        return 1;
+    }));
+
+    // Buckets of an LSH table, scanned for the bucket of every point of the pool. An operation is a bucket entry.
+    uint32_t table_size = POOL / 8;
+    HashTable<LshAmplifiedHash> table(table_size, new LshAmplifiedHash(dim, WINDOW, LSH_K));
+
+    vector<uint32_t> hashes(POOL);
+    for (uint32_t i = 0; i < POOL; i++) {
+        table.insert(*data[i]);
+        hashes[i] = table.get_hash(*data[i]);
+    }
+
+    // Querying trick only: entries with the full hash of the query
+    out.push_back(measure("bucket scan, hash match", dim, sizeof(Bucket::value_type), [&]() {
+        auto& bucket = table.bucket(hashes[next] % table_size);
+
+        uint32_t matches = 0;
+        for (auto& entry : bucket)
+            matches += entry.first == hashes[next];
+
+        keep(matches);
+        next = (next + 1) % POOL;
+        return bucket.size();
+    }));
+
+    // As LSH::kANN, the distance to every entry
+    out.push_back(measure("bucket scan, l2_distance", dim, sizeof(Bucket::value_type) + dim, [&]() {
+        auto& bucket = table.bucket(hashes[next] % table_size);
+        auto& query = data[next]->data();
+
+        for (auto& entry : bucket)
+            keep(l2_distance(query, entry.second->data()));
+
+        next = (next + 1) % POOL;
+        return bucket.size();
+    }));
+}
+
+// Selection of the TOP closest of CANDIDATES (label, distance) pairs. An operation is a candidate.
+static void top_k(vector<Measurement>& out) {
+    vector<vector<PAIR>> sets(16, vector<PAIR>(CANDIDATES));
+    for (auto& set : sets) {
+        Vector<double> distances(CANDIDATES, UNIFORM, 0, 1);
+        for (uint32_t i = 0; i < CANDIDATES; i++)
+            set[i] = PAIR(i + 1, distances[i]);
+    }
+
+    uint32_t next = 0;
+
+    // As LSH::kANN and Cube::kANN: every candidate is pushed to a min heap, then TOP are popped
+    out.push_back(measure("top-k, min heap of all", 0, sizeof(PAIR), [&]() {
+        auto comparator = [](const PAIR t1, const PAIR t2) { return t1.second > t2.second; };
+        priority_queue<PAIR, vector<PAIR>, decltype(comparator)> pq(comparator);
+
+        for (auto& candidate : sets[next])
+            pq.push(candidate);
+
+        for (uint32_t k = 0; k < TOP && !pq.empty(); k++) {
+            keep(pq.top());
+            pq.pop();
+        }
+
+        next = (next + 1) % sets.size();
+        return CANDIDATES;
+    }));
+
+    // As the trees: a max heap bounded to TOP entries
+    out.push_back(measure("top-k, bounded max heap", 0, sizeof(PAIR), [&]() {
+        auto comparator = [](const PAIR t1, const PAIR t2) { return t1.second < t2.second; };
+        priority_queue<PAIR, vector<PAIR>, decltype(comparator)> pq(comparator);
+
+        for (auto& candidate : sets[next]) {
+            if (pq.size() < TOP)
+                pq.push(candidate);
+            else if (candidate.second < pq.top().second) {
+                pq.pop();
+                pq.push(candidate);
+            }
+        }
+
+        keep(pq.top());
+        next = (next + 1) % sets.size();
+        return CANDIDATES;
+    }));
+}
+
+int main(int argc, const char* argv[]) {
+try {
+    ArgParser parser = ArgParser();
+
+    parser.add("o", STRING);
+    parser.add("repetitions", UINT, "15");
+    parser.add("warmup", UINT, "200");
+    parser.parse(argc, argv);
+
+    repetitions = max(parser.value<uint32_t>("repetitions"), 1u);
+    warmup_ns = (uint64_t)parser.value<uint32_t>("warmup") * 1000000;
+
+    // Staying on one core keeps the time stamp counter and the caches consistent between repetitions
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+        cerr << "Could not pin to a core, results may be noisier" << endl;
+
+    vector<Measurement> results;
+    for (uint32_t dim : { 784, 16 })
+        kernels(dim, results);
+    top_k(results);
+
+    cout << left << setw(36) << "Kernel" << right << setw(5) << "dim" << setw(11) << "ns/op" << setw(11) << "best"
+         << setw(11) << "TSC/op" << setw(10) << "bytes/op" << setw(9) << "GB/s" << setw(9) << "spread" << endl;
+
+    for (auto& result : results) {
+        cout << left << setw(36) << result.kernel << right << setw(5) << (result.dim ? to_string(result.dim) : "-")
+             << fixed << setprecision(2) << setw(11) << result.ns << setw(11) << result.fastest
+             << setw(11) << result.ticks << setprecision(0) << setw(10) << result.bytes
+             << setprecision(2) << setw(9) << result.bytes / result.ns
+             << setprecision(1) << setw(8) << 100 * result.spread << "%" << endl;
+    }
+
+    if (!parser.parsed("o"))
+        return 0;
+
+    string csv_path = parser.value<string>("o");
+    ofstream csv_file(csv_path, ios::out);
+    if (csv_file.fail())
+        throw runtime_error(csv_path + " could not be opened!\n");
+
+    csv_file << "kernel,dim,ns_per_op,best_ns_per_op,tsc_ticks_per_op,bytes_per_op,spread" << endl;
+    for (auto& result : results) {
+        csv_file << field(result.kernel) << "," << result.dim << "," << fixed << setprecision(3) << result.ns << ","
+                 << result.fastest << "," << result.ticks << "," << setprecision(0) << result.bytes << ","
+                 << setprecision(4) << result.spread << endl;
+    }
+}
+catch (exception& e) {
+    cerr << e.what();
+    return -1;
+}
+    return 0;
+}
@@ -17,7 +17,7 @@ df_rtime = df[df['Metric'] == 'RTime'].drop(columns=['Metric'])
 def plot_curves(sizes, metrics, dfs, y_ticks):
     _, axes = plt.subplots(2, 2, figsize=(16,13))
 
-    def plot(bmin, bmax, xvalues, LSH, Cube, GNNS, MRNG,
+    def plot(bmin, bmax, xvalues, LSH, Cube, GNNS, MRNG, HNSW, IVF,
             xticks, yticks, xlabel, ylabel, i, j):
 
         ax = axes[i][j]
@@ -30,10 +30,14 @@ def plot_curves(sizes, metrics, dfs, y_ticks):
         cond_cube = (Cube >= bmin) & (Cube <= bmax)
         cond_gnns = (GNNS >= bmin) & (GNNS <= bmax)
         cond_mrng = (MRNG >= bmin) & (MRNG <= bmax)
+        cond_hnsw = (HNSW >= bmin) & (HNSW <= bmax)
+        cond_ivf  = (IVF >= bmin) & (IVF <= bmax)
         ax.plot(xvalues[cond_lsh], LSH[cond_lsh] , ".-", label="LSH")
         ax.plot(xvalues[cond_cube], Cube[cond_cube], ".-", label="Cube")
         ax.plot(xvalues[cond_gnns], GNNS[cond_gnns], ".-", label="GNNS")
         ax.plot(xvalues[cond_mrng], MRNG[cond_mrng], ".-", label="MRNG")
+        ax.plot(xvalues[cond_hnsw], HNSW[cond_hnsw], ".-", label="HNSW")
+        ax.plot(xvalues[cond_ivf], IVF[cond_ivf], ".-", label="IVF")
 
         ax.legend(loc="best")
 
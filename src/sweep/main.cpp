@@ -0,0 +1,404 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+#include "Histogram.hpp"
+#include "ArgParser.hpp"
+#include "FileParser.hpp"
+#include "lsh.hpp"
+#include "cube.hpp"
+#include "ivf.hpp"
+#include "Graph.hpp"
+
+// Recall is measured against the exact 100 nearest neighbours
+#define DEPTH 100
+
+using namespace std;
+
+// Search-time settings swept for every index, from fast and coarse to slow and accurate
+static const uint32_t cube_sweep[][2] = { {1, 500}, {2, 1000}, {5, 2000}, {10, 6000}, {20, 12000}, {50, 30000} };
+static const uint32_t ivf_sweep[]     = { 1, 2, 4, 8, 16, 32, 64 };
+static const uint32_t gnns_sweep[][2] = { {1, 10}, {1, 30}, {5, 30}, {10, 40}, {20, 50} };
+static const uint32_t mrng_sweep[]    = { 100, 200, 300, 500, 1000, 2000 };
+static const uint32_t hnsw_sweep[]    = { 100, 128, 200, 400, 800 };
+
+// One point of the recall/throughput curve of an index
+typedef struct {
+	string algorithm;
+	string parameters;
+	double build;
+	double qps;
+	double recall[3];
+	Histogram latency;
+} Result;
+
+static const uint32_t depths[] = { 1, 10, DEPTH };
+
+// Distances of the exact 1st, 10th and 100th neighbour of every query, in parallel over the queries
+static vector<vector<double>> ground_truth(DataSet& train, DataSet& test) {
+	vector<vector<double>> out(test.size());
+	uint32_t depth = min((uint32_t)DEPTH, train.size());
+
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (uint32_t q = 0; q < test.size(); q++) {
+		auto& query = test[q]->data();
+
+		vector<double> distances(train.size());
+		for (uint32_t i = 0; i < train.size(); i++)
+			distances[i] = l2_distance(query, train[i]->data());
+
+		partial_sort(distances.begin(), distances.begin() + depth, distances.end());
+		for (auto k : depths)
+			out[q].push_back(distances[min(k, depth) - 1]);
+	}
+
+	return out;
+}
+
+// Results of a query as close as the k-th exact neighbour, so that ties do not count as misses
+static double recall(const vector<PAIR>& found, double kth, uint32_t k) {
+	uint32_t hits = 0;
+	for (uint32_t i = 0; i < min(k, (uint32_t)found.size()); i++)
+		hits += found[i].second <= kth * (1 + 1e-6);
+
+	return (double)hits / k;
+}
+
+// Runs every query once against an index set up for one point of its sweep. With more than one thread
+// the queries are split among them and the throughput is that of the whole batch.
+static Result measure(string algorithm, string parameters, double build, DataSet& test, uint32_t threads,
+					  const vector<vector<double>>& truth, function<vector<PAIR>(DataPoint&)> search) {
+
+	Result result = { algorithm, parameters, build, 0, {0, 0, 0}, Histogram() };
+	vector<vector<PAIR>> found(test.size());
+
+	Stopwatch timer;
+	timer.start();
+
+	#pragma omp parallel num_threads(threads)
+	{
+		Histogram latency;
+		Stopwatch clock;
+
+		#pragma omp for schedule(dynamic, 1) nowait
+		for (uint32_t q = 0; q < test.size(); q++) {
+			clock.start();
+			found[q] = search(*test[q]);
+			latency.record(clock.elapsed());
+		}
+
+		#pragma omp critical
+		result.latency.merge(latency);
+	}
+
+	double elapsed = timer.stop();
+
+	result.qps = test.size() / max(elapsed, 1e-9);
+	for (uint32_t q = 0; q < test.size(); q++) {
+		for (uint32_t d = 0; d < 3; d++)
+			result.recall[d] += recall(found[q], truth[q][d], depths[d]) / test.size();
+	}
+
+	cout << "  " << algorithm << " " << parameters << ": recall@10 " << fixed << setprecision(4) << result.recall[1]
+		 << ", " << setprecision(1) << result.qps << " queries/s, p99 " << setprecision(4)
+		 << result.latency.percentile(99) / 1e6 << " ms" << endl;
+
+	return result;
+}
+
+// Build (or load) step of an index, reported like the other drivers
+static double timed(string message, function<void()> step) {
+	Stopwatch timer;
+	cout << message << "... " << flush;
+	timer.start();
+	step();
+
+	double elapsed = timer.stop();
+	cout << "Done! (" << std::fixed << std::setprecision(3) << elapsed << " seconds)" << endl;
+	return elapsed;
+}
+
+int main(int argc, const char* argv[]){
+try{
+
+	ArgParser parser = ArgParser();
+
+	parser.add("d", STRING);
+	parser.add("q", STRING);
+	parser.add("o", STRING);
+	parser.add("json", STRING);
+	parser.add("config", STRING);
+	parser.add("size", UINT, "0");
+	parser.add("queries", UINT, "1000");
+	parser.add("threads", UINT, "1");
+	parser.add("algorithms", STRING, "LSH,Cube,IVF,GNNS,MRNG,HNSW");
+	parser.add("gnns_load", STRING);
+	parser.add("gnns_save", STRING);
+	parser.add("mrng_load", STRING);
+	parser.add("mrng_save", STRING);
+	parser.add("hnsw_load", STRING);
+	parser.add("hnsw_save", STRING);
+
+	parser.parse(argc,argv);
+
+	if (!parser.parsed("d"))
+		throw runtime_error("Missing data path argument -d\n");
+
+	if (!parser.parsed("q"))
+		throw runtime_error("Missing query path argument -q\n");
+
+	if (!parser.parsed("o"))
+		throw runtime_error("Missing csv path argument -o\n");
+
+	if (!parser.parsed("config"))
+		throw runtime_error("Missing configuration path argument -config\n");
+
+	string csv_path = parser.value<string>("o");
+	string json_path = parser.parsed("json") ? parser.value<string>("json") : "";
+
+	auto path = [&](string flag) { return parser.parsed(flag) ? parser.value<string>(flag) : string(""); };
+
+	// Comma separated list of the indices to sweep
+	string algorithms = "," + parser.value<string>("algorithms") + ",";
+	auto enabled = [&](string name) { return algorithms.find("," + name + ",") != string::npos; };
+
+	FileParser file_parser = FileParser();
+	file_parser.add("window", "window", 2600);
+
+	file_parser.add("lsh_k", "lsh_k", 4);
+	file_parser.add("lsh_L", "lsh_L", 5);
+
+	file_parser.add("cube_k", "cube_k", 14);
+	file_parser.add("cube_M", "cube_M", 10);
+	file_parser.add("cube_probes", "cube_probes", 2);
+
+	file_parser.add("ivf_nlist", "ivf_nlist", 100);
+	file_parser.add("ivf_nprobe", "ivf_nprobe", 8);
+
+	file_parser.add("graph_approx", "graph_approx", 1);
+	file_parser.add("graph_k", "graph_k", 50);
+	file_parser.add("graph_T", "graph_T", 10);
+	file_parser.add("mrng_entries", "mrng_entries", 0);
+	file_parser.add("mrng_seeds", "mrng_seeds", 1);
+
+	file_parser.add("hnsw_M", "hnsw_M", 16);
+	file_parser.add("hnsw_efC", "hnsw_efC", 200);
+
+	file_parser.parse(parser.value<string>("config"));
+
+	DataSet* train = nullptr;
+	DataSet* test = nullptr;
+	timed("Loading data", [&]() {
+		train = new DataSet(parser.value<string>("d"), parser.value<uint32_t>("size"));
+		test = new DataSet(parser.value<string>("q"), parser.value<uint32_t>("queries"), train->quantizer());
+	});
+
+	vector<vector<double>> truth;
+	timed("Computing ground truth", [&]() { truth = ground_truth(*train, *test); });
+
+	uint32_t window = file_parser.value("window");
+	uint32_t threads = max(parser.value<uint32_t>("threads"), 1u);
+	vector<Result> results;
+
+
+	/////////
+	// LSH //
+	/////////
+
+	// The graphs are built with one of the hash based indices, so it is kept around when they need it
+	uint32_t approx_id = file_parser.value("graph_approx");
+	bool graphs = enabled("GNNS") || enabled("MRNG");
+
+	// Built once, without any search-time knob
+	LSH* lsh = nullptr;
+	if (enabled("LSH") || (graphs && approx_id == 1)) {
+		uint32_t lsh_k = file_parser.value("lsh_k"), lsh_L = file_parser.value("lsh_L");
+		double build = timed("Populating LSH HashTables", [&]() { lsh = new LSH(*train, window, lsh_k, lsh_L, train->dim() / 8); });
+
+		if (enabled("LSH"))
+			results.push_back(measure("LSH", "k=" + to_string(lsh_k) + ";L=" + to_string(lsh_L), build, *test, threads, truth,
+									  [&](DataPoint& q) { return lsh->kANN(q, DEPTH, l2_distance); }));
+	}
+
+
+	//////////
+	// Cube //
+	//////////
+
+	// The configured settings are restored after the sweep, for the construction of the graphs
+	uint32_t cube_probes = file_parser.value("cube_probes"), cube_M = file_parser.value("cube_M");
+
+	Cube* cube = nullptr;
+	if (enabled("Cube") || (graphs && approx_id == 2)) {
+		double build = timed("Populating Cube HashTable", [&]() {
+			cube = new Cube(*train, window, file_parser.value("cube_k"), cube_probes, cube_M);
+		});
+
+		for (auto setting : cube_sweep) {
+			if (!enabled("Cube"))
+				break;
+
+			cube->set_probes(setting[0], setting[1]);
+			results.push_back(measure("Cube", "probes=" + to_string(setting[0]) + ";M=" + to_string(setting[1]), build, *test, threads, truth,
+									  [&](DataPoint& q) { return cube->kANN(q, DEPTH, l2_distance); }));
+		}
+
+		cube->set_probes(cube_probes, cube_M);
+	}
+
+
+	/////////
+	// IVF //
+	/////////
+
+	uint32_t ivf_nprobe = file_parser.value("ivf_nprobe");
+
+	IVF* ivf = nullptr;
+	if (enabled("IVF") || (graphs && approx_id == 3)) {
+		double build = timed("Populating IVF lists", [&]() { ivf = new IVF(*train, file_parser.value("ivf_nlist"), ivf_nprobe); });
+
+		for (auto nprobe : ivf_sweep) {
+			if (!enabled("IVF") || nprobe > ivf->lists())
+				break;
+
+			ivf->set_probes(nprobe);
+			results.push_back(measure("IVF", "nprobe=" + to_string(nprobe), build, *test, threads, truth,
+									  [&](DataPoint& q) { return ivf->kANN(q, DEPTH, l2_distance); }));
+		}
+
+		ivf->set_probes(ivf_nprobe);
+	}
+
+
+	////////////
+	// Graphs //
+	////////////
+
+	// Approximator used for the construction of GNNS and MRNG: 1 for LSH, 2 for Cube, 3 for IVF
+	Approximator* approx = approx_id == 1 ? (Approximator*)lsh : approx_id == 3 ? (Approximator*)ivf : (Approximator*)cube;
+	uint32_t k = file_parser.value("graph_k");
+
+	SearchParams params;
+	params.N     = DEPTH;
+	params.T     = file_parser.value("graph_T");
+	params.seeds = file_parser.value("mrng_seeds");
+
+	// Build or load, then save if asked
+	auto prepare = [&](string name, string flag, Graph*& graph, function<Graph*(string)> create) {
+		string load = path(flag + "_load"), save = path(flag + "_save");
+		double build = timed((load.empty() ? "Creating " : "Loading ") + name + " graph", [&]() { graph = create(load); });
+
+		if (!save.empty())
+			timed("Saving " + name + " graph", [&]() { graph->save(save); });
+
+		return build;
+	};
+
+	Graph* graph = nullptr;
+	if (enabled("GNNS")) {
+		double build = prepare("GNNS", "gnns", graph, [&](string load) { return new GNNS(*train, approx, l2_distance, k, load); });
+
+		for (auto setting : gnns_sweep) {
+			params.R = setting[0], params.E = setting[1];
+			results.push_back(measure("GNNS", "R=" + to_string(params.R) + ";E=" + to_string(params.E), build, *test, threads, truth,
+									  [&](DataPoint& q) { return graph->query(q.data(), params); }));
+		}
+
+		delete graph;
+	}
+
+	if (enabled("MRNG")) {
+		uint32_t entries = file_parser.value("mrng_entries");
+		double build = prepare("MRNG", "mrng", graph, [&](string load) {
+			return new MRNG(*train, approx, l2_distance, l2_distance, k, entries, load);
+		});
+
+		for (auto L : mrng_sweep) {
+			params.L = L;
+			results.push_back(measure("MRNG", "L=" + to_string(L), build, *test, threads, truth,
+									  [&](DataPoint& q) { return graph->query(q.data(), params); }));
+		}
+
+		delete graph;
+	}
+
+	if (enabled("HNSW")) {
+		uint32_t M = file_parser.value("hnsw_M"), efC = file_parser.value("hnsw_efC");
+		double build = prepare("HNSW", "hnsw", graph, [&](string load) { return new HNSW(*train, l2_distance, M, efC, load); });
+
+		for (auto ef : hnsw_sweep) {
+			params.ef = ef;
+			results.push_back(measure("HNSW", "ef=" + to_string(ef), build, *test, threads, truth,
+									  [&](DataPoint& q) { return graph->query(q.data(), params); }));
+		}
+
+		delete graph;
+	}
+
+	delete lsh;
+	delete cube;
+	delete ivf;
+
+
+	////////////
+	// Output //
+	////////////
+
+	ofstream csv_file(csv_path, ios::out);
+	if (csv_file.fail())
+		throw runtime_error(csv_path + " could not be opened!\n");
+
+	// Latencies in milliseconds
+	auto tail = [](const Histogram& latency) {
+		return vector<double>{ latency.percentile(50) / 1e6, latency.percentile(90) / 1e6, latency.percentile(99) / 1e6,
+							   latency.percentile(99.9) / 1e6, latency.max() / 1e6 };
+	};
+
+	csv_file << "algorithm,parameters,build_seconds,qps,recall@1,recall@10,recall@100,p50_ms,p90_ms,p99_ms,p99.9_ms,max_ms" << endl;
+	for (auto& result : results) {
+		csv_file << result.algorithm << "," << result.parameters << "," << fixed << setprecision(3) << result.build << ","
+				 << setprecision(1) << result.qps << "," << setprecision(4) << result.recall[0] << ","
+				 << result.recall[1] << "," << result.recall[2];
+
+		for (auto value : tail(result.latency))
+			csv_file << "," << value;
+		csv_file << endl;
+	}
+
+	if (!json_path.empty()) {
+		ofstream json_file(json_path, ios::out);
+		if (json_file.fail())
+			throw runtime_error(json_path + " could not be opened!\n");
+
+		json_file << "[" << endl;
+		for (uint32_t i = 0; i < results.size(); i++) {
+			auto& result = results[i];
+			json_file << "  {\"algorithm\": \"" << result.algorithm << "\", \"parameters\": \"" << result.parameters << "\", "
+					  << "\"build_seconds\": " << fixed << setprecision(3) << result.build << ", "
+					  << "\"qps\": " << setprecision(1) << result.qps << ", " << setprecision(4)
+					  << "\"recall@1\": " << result.recall[0] << ", \"recall@10\": " << result.recall[1] << ", "
+					  << "\"recall@100\": " << result.recall[2];
+
+			auto values = tail(result.latency);
+			const char* keys[] = { "p50_ms", "p90_ms", "p99_ms", "p99.9_ms", "max_ms" };
+			for (uint32_t j = 0; j < values.size(); j++)
+				json_file << ", \"" << keys[j] << "\": " << values[j];
+
+			json_file << "}" << (i + 1 < results.size() ? "," : "") << endl;
+		}
+		json_file << "]" << endl;
+	}
+
+	delete train;
+	delete test;
+}
+catch (exception& e){
+	cerr << e.what();
+	return -1;
+}
+	return 0;
+}